@@ -13,14 +13,14 @@ https://github.com/NDBCK/Ansluta-Remote-Controller
  **************************************************************/
 
  #include "Ansulta.h"
+ #include "metrics.h"
+ #include "trace.h"
+ #include "capture.h"
 
 Ansulta::Ansulta()
 {
   p_address_found = false;
-  p_first_info = false;
-  p_count_c = 0;
   // delays are in microseconds
-  delayA = 1;  //1++ 0-- No delay is also possible
   // delayB = 15000; // 10000-- 20000++ 15000++     //KRITISCH
   delayB = 2000;  // delay in SendStrobe while send command
   // delayC = 10;  //255++ 128++ 64--
@@ -33,6 +33,26 @@ Ansulta::Ansulta()
   AddressByteB = 0x00;
   p_led_state = OFF;
   p_count_repeats = 0;
+  p_cal_valid = false;
+  p_cal_channel = 0;
+  p_cal_fscal3 = 0;
+  p_cal_fscal2 = 0;
+  p_cal_fscal1 = 0;
+  p_cal_ms = 0;
+  memset(p_tx_frames, 0, sizeof(p_tx_frames));
+  p_tx_frames_next = 0;
+  p_rx_fill = 0;
+  p_tx_pending = false;
+  p_tx_command = 0;
+  p_tx_count = 0;
+  p_tx_backoffs = 0;
+  p_tx_due_ms = 0;
+  p_tx_queued_ms = 0;
+  p_learn_state = LEARN_IDLE;
+  p_learn_start_ms = 0;
+  p_learn_timeout_ms = 0;
+  p_demo_step = 0;
+  p_demo_last_ms = 0;
 }
 
 Ansulta::~Ansulta()
@@ -52,43 +72,54 @@ void Ansulta::init(){
   init_CC2500();
   //  SendStrobe(CC2500_SPWD); //Enter power down mode    -   Not used in the prototype
   WriteReg(0x3E, 0xFF);  //Maximum transmit power - write 0xFF to 0x3E (PATABLE)
+  WriteReg(REG_MCSM0, MCSM0_MANUAL_CAL);
+  WriteReg(REG_MCSM1, MCSM1_RXOFF_RX);
+  WriteReg(REG_IOCFG1,0x01);   // Switch MISO to output if a packet has been received or not
+  p_rx_fill = 0;
+  if (p_cal_valid && p_cal_channel == VAL_CHANNR) {
+    // the reset cleared the calibration, the cached result is still valid
+    WriteReg(REG_FSCAL3, p_cal_fscal3);
+    WriteReg(REG_FSCAL2, p_cal_fscal2);
+    WriteReg(REG_FSCAL1, p_cal_fscal1);
+  } else {
+    calibrate();
+  }
   DEBUG_PRINTLN(" - Done");
 }
 
 void Ansulta::serverLoop()
 {
-  //Some demo loop
-  if (!p_address_found) {
+  if (!p_address_found && p_learn_state == LEARN_IDLE) {
     /*** Read adress from another remote wireless ***/
     /*** Push the button on the original remote ***/
-  
-    ReadAddressBytes(); //Read Address Bytes From a remote by sniffing its packets wireless
-    if (p_address_found) {
-      Serial.print("50%");
-      light_ON_50();
-      delay(1000);
-      Serial.print("100%");
-      light_ON_100();
-      delay(1000);
-      Serial.print("50%");
-      light_ON_50();
-      delay(1000);
-      Serial.print("OFF%");
-      light_OFF();
-    }
+    // without address listen until a remote is found
+    start_learning(0);
+  }
+  if (p_learn_state == LEARN_LISTENING && p_learn_timeout_ms > 0 && millis() - p_learn_start_ms > p_learn_timeout_ms) {
+    DEBUG_PRINTLN("Ansulta: learning timed out");
+    p_learn_state = LEARN_IDLE;
+  }
+  if (p_demo_step > 0 && millis() - p_demo_last_ms >= LEARN_DEMO_STEP_MS) {
+    demo_step();
+  }
+  if (millis() - p_cal_ms > CAL_INTERVAL_MS) {
+    calibrate();
+  }
+  if (p_tx_pending && (long)(millis() - p_tx_due_ms) >= 0) {
+    process_tx();
   }
   // backup case if it is not work
-  if (p_count_repeats > 0) {
+  if (p_count_repeats > 0 && !p_tx_pending) {
     p_count_repeats--;
     switch(p_led_state) {
       case ON_50:
-        SendCommand(AddressByteA,AddressByteB, Light_ON_50);
+        queue_command(Light_ON_50, 10);
         break;
       case ON_100:
-        SendCommand(AddressByteA,AddressByteB, Light_ON_100);
+        queue_command(Light_ON_100, 10);
         break;
       case OFF:
-        SendCommand(AddressByteA,AddressByteB, Light_OFF);
+        queue_command(Light_OFF, 10);
         break;
     }
   }
@@ -100,6 +131,30 @@ void Ansulta::serverLoop()
   // delay(1000);
 }
 
+void Ansulta::calibrate()
+{
+  SendStrobe(CC2500_SIDLE, 0);
+  SendStrobe(CC2500_SCAL, 0);
+  unsigned long start_us = micros();
+  while ((ReadStatus(REG_MARCSTATE) & 0x1F) != MARCSTATE_IDLE) {
+    if (micros() - start_us > CAL_TIMEOUT_US) {
+      DEBUG_PRINTLN("Ansulta: calibration timed out");
+      break;
+    }
+  }
+  // FSCAL3..FSCAL1 are consecutive, one burst without the delay of ReadReg()
+  byte fscal[3];
+  ReadBurst(REG_FSCAL3, fscal, 3);
+  p_cal_fscal3 = fscal[0];
+  p_cal_fscal2 = fscal[1];
+  p_cal_fscal1 = fscal[2];
+  p_cal_channel = VAL_CHANNR;
+  p_cal_valid = true;
+  p_cal_ms = millis();
+  METRIC_INC(radio_calibrations);
+  TRACE_EVENT(TRACE_RADIO_CAL, p_cal_fscal1, (p_cal_fscal3 << 8) | p_cal_fscal2);
+}
+
 void Ansulta::add_handler(AnsultaCallback *handler) {
   if (handler != NULL) {
     p_ansulta_handler.push_back(handler);
@@ -107,6 +162,7 @@ void Ansulta::add_handler(AnsultaCallback *handler) {
 }
 
 void Ansulta::inform_handler(int state, bool by_ansulta_ctrl) {
+  TRACE_EVENT(TRACE_LIGHT_STATE, state, by_ansulta_ctrl);
   for (unsigned int idx = 0; idx < p_ansulta_handler.size(); idx++) {
     p_ansulta_handler[idx]->light_state_changed(state, by_ansulta_ctrl);
   }
@@ -134,6 +190,74 @@ byte Ansulta::get_address_b()
   return AddressByteB;
 }
 
+void Ansulta::start_learning(unsigned long timeout_ms)
+{
+  DEBUG_PRINTLN("Ansulta: Listening for an Address");
+  p_learn_state = LEARN_LISTENING;
+  p_learn_start_ms = millis();
+  p_learn_timeout_ms = timeout_ms;
+}
+
+void Ansulta::stop_learning()
+{
+  if (p_learn_state == LEARN_LISTENING) {
+    DEBUG_PRINTLN("Ansulta: learning stopped");
+    p_learn_state = LEARN_IDLE;
+  }
+}
+
+byte Ansulta::get_learn_state()
+{
+  return p_learn_state;
+}
+
+bool Ansulta::is_searching()
+{
+  return p_learn_state == LEARN_LISTENING && p_learn_timeout_ms > 0;
+}
+
+void Ansulta::learn_address(byte addr_a, byte addr_b, byte state)
+{
+  AddressByteA = addr_a;
+  AddressByteB = addr_b;
+  p_address_found = true;
+  p_led_state = state;
+  p_learn_state = LEARN_FOUND;
+  DEBUG_PRINT("Ansulta: Address Bytes found: ");
+  if (AddressByteA < 0x10) { DEBUG_PRINT("0"); }
+  DEBUG_FPRINT(AddressByteA, HEX);
+  if (AddressByteB < 0x10) { DEBUG_PRINT("0"); }
+  DEBUG_FPRINTLN(AddressByteB, HEX);
+  // show the success by the demo sequence, one command per LEARN_DEMO_STEP_MS,
+  // the first one is sent by serverLoop() after the received frames are handled
+  p_demo_step = 1;
+  p_demo_last_ms = millis() - LEARN_DEMO_STEP_MS;
+}
+
+void Ansulta::demo_step()
+{
+  p_demo_last_ms = millis();
+  switch (p_demo_step++) {
+    case 1:
+      DEBUG_PRINTLN("Ansulta: demo 50%");
+      light_ON_50();
+      break;
+    case 2:
+      DEBUG_PRINTLN("Ansulta: demo 100%");
+      light_ON_100();
+      break;
+    case 3:
+      DEBUG_PRINTLN("Ansulta: demo 50%");
+      light_ON_50();
+      break;
+    default:
+      DEBUG_PRINTLN("Ansulta: demo OFF");
+      light_OFF();
+      p_demo_step = 0;
+      break;
+  }
+}
+
 int Ansulta::get_brightness()
 {
   return p_brightness;
@@ -145,7 +269,7 @@ void Ansulta::light_ON_50(int count, bool disable_motion_detection, int brightne
   p_count_repeats = REPEATS;
   p_led_state = ON_50;
   p_brightness = brightness;
-  SendCommand(AddressByteA, AddressByteB, Light_ON_50, count);
+  queue_command(Light_ON_50, count);
   // delay(1000);
   inform_handler(p_led_state, disable_motion_detection);
 }
@@ -156,7 +280,7 @@ void Ansulta::light_ON_100(int count, bool disable_motion_detection, int brightn
   p_count_repeats = REPEATS;
   p_led_state = ON_100;
   p_brightness = brightness;
-  SendCommand(AddressByteA, AddressByteB, Light_ON_100, count);
+  queue_command(Light_ON_100, count);
   // delay(1000);
   inform_handler(p_led_state, disable_motion_detection);
 }
@@ -167,7 +291,7 @@ void Ansulta::light_OFF(int count, bool disable_motion_detection, int brightness
   p_count_repeats = REPEATS;
   p_led_state = OFF;
   p_brightness = brightness;
-  SendCommand(AddressByteA, AddressByteB, Light_OFF, count);
+  queue_command(Light_OFF, count);
   // delay(1000);
   inform_handler(p_led_state, disable_motion_detection);
 }
@@ -180,111 +304,134 @@ int Ansulta::get_state()
 
 void Ansulta::read_cmd()
 {
-    SendStrobe(CC2500_SRX);
-    WriteReg(REG_IOCFG1,0x01);   // Switch MISO to output if a packet has been received or not
-    delay(10);
-    byte PacketLength = ReadReg(CC2500_FIFO);
-    if (PacketLength > 1) {      
-      byte recvPacket[PacketLength];
-      if (PacketLength <= 8) {                       //A packet from the remote cant be longer than 8 bytes
-        DEBUG_PRINTLN();
-        DEBUG_PRINT("Ansulta: Packet received: ");
-        DEBUG_FPRINT(PacketLength, DEC);
-        DEBUG_PRINTLN(" bytes");
-        for (byte i = 0; i < PacketLength; i++){    //Read the received data from CC2500
-          recvPacket[i] = ReadReg(CC2500_FIFO);
-          if (recvPacket[i] < 0x10) { DEBUG_PRINT("0"); }
-          DEBUG_FPRINT(recvPacket[i], HEX);
-        }
-      }
-        
-      byte start=0;
-      while((recvPacket[start] != 0x55) && (start < PacketLength)){   //Search for the start of the sequence
-        start++;
-      }
-      if (recvPacket[start+1] == 0x01 && recvPacket[start+5] == 0xAA){   //If the bytes match an Ikea remote sequence
-        if ( (AddressByteA == recvPacket[start+2]) && (AddressByteB == recvPacket[start+3])) {
-          p_led_state = recvPacket[start+4];
-          if (p_led_state == OFF) {
-            p_brightness = 1;
-          } else if (p_led_state == ON_50) {
-            p_brightness = 127;
-          } else if (p_led_state == ON_100) {
-            p_brightness = 254;
-          }
-          DEBUG_PRINTLN();
-          DEBUG_PRINT("Ansulta: new light intensity: ");
-          DEBUG_FPRINT(p_led_state, HEX);
-          DEBUG_PRINTLN();
-          inform_handler(p_led_state, true);
-        }
-      } 
-      SendStrobe(CC2500_SIDLE);      // Needed to flush RX FIFO
-      SendStrobe(CC2500_SFRX);       // Flush RX FIFO
-    } 
-}
-
-void Ansulta::ReadAddressBytes()
-{     //Read Address Bytes From a remote by sniffing its packets wireless
-   byte tries=0;
-
-   if(!p_first_info) {
-    DEBUG_PRINTLN("Ansulta: Listening for an Address ");
-    p_first_info = true;
-   }
-   
-   while((tries < MAX_LEARN_TRIES) && (!p_address_found)){ //Try to listen for the address 200 times
-      p_count_c++;
-      if (p_count_c > 80) {
-        p_count_c = 0;
-        DEBUG_PRINTLN("c");
-      } else {
-        DEBUG_PRINT("c");
+  byte rxbytes = ReadFifoBytes(REG_RXBYTES);
+  byte marcstate = ReadStatus(REG_MARCSTATE) & 0x1F;
+  // after TX, a calibration or an overflow the radio is no longer in RX
+  bool receiving = marcstate != MARCSTATE_IDLE && marcstate != MARCSTATE_RXFIFO_OVERFLOW;
+  if (rxbytes & 0x80) {
+    DEBUG_PRINTLN("Ansulta: RX FIFO overflow");
+    METRIC_INC(radio_rx_overflows);
+    receiving = false;
+  }
+  int count = min((int)(rxbytes & 0x7F), RX_BUFFER_SIZE - p_rx_fill);
+  if (receiving && count > 0) {
+    // the FIFO must not be emptied during the reception of a frame,
+    // the last byte is only read if it completes a frame
+    ReadBurst(CC2500_FIFO, p_rx_buffer + p_rx_fill, count - 1);
+    p_rx_fill += count - 1;
+    if (rx_missing() == 1) {
+      ReadBurst(CC2500_FIFO, p_rx_buffer + p_rx_fill, 1);
+      p_rx_fill++;
+    }
+  } else if (count > 0) {
+    ReadBurst(CC2500_FIFO, p_rx_buffer + p_rx_fill, count);
+    p_rx_fill += count;
+  }
+
+  int pos = 0;
+  AnsultaFrame frame;
+  while (pos < p_rx_fill) {
+    AnsultaFrameType type = decode_frame(p_rx_buffer + pos, p_rx_fill - pos, frame);
+    if (type == FRAME_INCOMPLETE) {
+      break;
+    }
+    handle_frame(p_rx_buffer + pos, frame);
+    if (type == FRAME_INVALID) {
+      // start again with an empty FIFO
+      pos = p_rx_fill;
+      receiving = false;
+      break;
+    }
+    pos += frame.length;
+  }
+  p_rx_fill -= pos;
+  memmove(p_rx_buffer, p_rx_buffer + pos, p_rx_fill);
+
+  if (!receiving) {
+    // a frame in reception is lost
+    SendStrobe(CC2500_SIDLE, 0);
+    SendStrobe(CC2500_SFRX, 0);
+    p_rx_fill = 0;
+    SendStrobe(CC2500_SRX, 0);
+  }
+}
+
+// bytes missing to complete the last frame in the buffer, 0 if it ends with a complete frame
+int Ansulta::rx_missing()
+{
+  int pos = 0;
+  while (pos < p_rx_fill) {
+    if (p_rx_buffer[pos] > RX_FRAME_MAX) {
+      return 0;
+    }
+    pos += p_rx_buffer[pos] + 3;
+  }
+  return pos - p_rx_fill;
+}
+
+AnsultaFrameType Ansulta::decode_frame(const byte *data, int size, AnsultaFrame& frame)
+{
+  frame.type = FRAME_INCOMPLETE;
+  if (size < 1) {
+    return frame.type;
+  }
+  byte length = data[0];
+  if (length > RX_FRAME_MAX) {
+    frame.type = FRAME_INVALID;
+    frame.length = 1;
+    return frame.type;
+  }
+  if (size < length + 3) {
+    return frame.type;
+  }
+  frame.length = length + 3;
+  frame.rssi = data[length + 1];
+  frame.lqi = data[length + 2];
+  frame.type = FRAME_REJECTED;
+  // the remote frame can be preceded by noise, it is searched in the payload
+  const byte *payload = data + 1;
+  for (int start = 0; start + ANSULTA_FRAME_SIZE <= length; start++) {
+    if (payload[start] == 0x55 && payload[start + 1] == 0x01 && payload[start + 5] == 0xAA) {
+      frame.type = FRAME_COMMAND;
+      frame.address_a = payload[start + 2];
+      frame.address_b = payload[start + 3];
+      frame.command = payload[start + 4];
+      break;
+    }
+  }
+  return frame.type;
+}
+
+void Ansulta::handle_frame(const byte *data, const AnsultaFrame& frame)
+{
+  TRACE_EVENT(TRACE_RX_PACKET, data[0], 0);
+  uint16_t address = 0;
+  if (frame.type == FRAME_COMMAND) {
+    METRIC_INC(radio_rx_decoded);
+    address = (frame.address_a << 8) | frame.address_b;
+    TRACE_EVENT(TRACE_RX_COMMAND, frame.command, address);
+    if (p_learn_state == LEARN_LISTENING) {
+      learn_address(frame.address_a, frame.address_b, frame.command);
+    } else if (AddressByteA == frame.address_a && AddressByteB == frame.address_b) {
+      p_led_state = frame.command;
+      if (p_led_state == OFF) {
+        p_brightness = 1;
+      } else if (p_led_state == ON_50) {
+        p_brightness = 127;
+      } else if (p_led_state == ON_100) {
+        p_brightness = 254;
       }
-      SendStrobe(CC2500_SRX);
-      WriteReg(REG_IOCFG1,0x01);   // Switch MISO to output if a packet has been received or not
-      delay(10);
-      byte PacketLength = ReadReg(CC2500_FIFO);
-      if (PacketLength > 1) {      
-//      if (digitalRead(MISO)) {      
-        byte recvPacket[PacketLength];
-        if (PacketLength <= 8) {                       //A packet from the remote cant be longer than 8 bytes
-          DEBUG_PRINTLN();
-          DEBUG_PRINT("Ansulta: Packet received: ");
-          DEBUG_FPRINT(PacketLength, DEC);
-          DEBUG_PRINTLN(" bytes");
-          for (byte i = 0; i < PacketLength; i++){    //Read the received data from CC2500
-            recvPacket[i] = ReadReg(CC2500_FIFO);
-            if (recvPacket[i] < 0x10) { DEBUG_PRINT("0"); }
-            DEBUG_FPRINT(recvPacket[i], HEX);
-          }
-        }
-          
-        byte start=0;
-        while((recvPacket[start] != 0x55) && (start < PacketLength)){   //Search for the start of the sequence
-          start++;
-        }
-        if (recvPacket[start+1] == 0x01 && recvPacket[start+5] == 0xAA){   //If the bytes match an Ikea remote sequence
-          p_address_found = true;
-          AddressByteA = recvPacket[start+2];                // Extract the addressbytes
-          AddressByteB = recvPacket[start+3];
-          p_led_state = recvPacket[start+4];
-          DEBUG_PRINTLN();
-          DEBUG_PRINT("Ansulta: Address Bytes found: ");
-          if (AddressByteA < 0x10) { DEBUG_PRINT("0"); }
-          DEBUG_FPRINT(AddressByteA, HEX);
-          if (AddressByteB < 0x10) { DEBUG_PRINT("0"); }
-          DEBUG_FPRINTLN(AddressByteB, HEX);
-        } 
-        SendStrobe(CC2500_SIDLE);      // Needed to flush RX FIFO
-        SendStrobe(CC2500_SFRX);       // Flush RX FIFO
-      } 
-      tries++;  //Another try has passed
-   }
-   if (p_address_found) {
-     DEBUG_PRINTLN();
-     DEBUG_PRINTLN("Ansulta: detected");
-   }
+      inform_handler(p_led_state, true);
+    }
+  } else {
+    METRIC_INC(radio_rx_rejected);
+    TRACE_EVENT(TRACE_RX_REJECTED, data[0], 0);
+  }
+  if (frame.type == FRAME_INVALID) {
+    capture_frame(data, 1, min(data[0] + 3, 255), false, address);
+  } else {
+    capture_frame(data, frame.length, frame.length, true, address);
+  }
 }
 
 byte Ansulta::ReadReg(byte addr)
@@ -300,6 +447,45 @@ byte Ansulta::ReadReg(byte addr)
   return y;  
 }
 
+// burst read in one chip select: count bytes of the RX FIFO or count consecutive config registers
+void Ansulta::ReadBurst(byte addr, byte *buffer, int count)
+{
+  if (count <= 0) {
+    return;
+  }
+  digitalWrite(SS,LOW);
+  while (digitalRead(MISO) == HIGH) {
+    };
+  SPI.transfer(addr | 0xC0);
+  for (int i = 0; i < count; i++) {
+    buffer[i] = SPI.transfer(0);
+  }
+  digitalWrite(SS,HIGH);
+}
+
+// RXBYTES and TXBYTES are valid if two reads agree, they can change while they are read (CC2500 errata)
+byte Ansulta::ReadFifoBytes(byte addr)
+{
+  byte value = ReadStatus(addr);
+  byte check;
+  while ((check = ReadStatus(addr)) != value) {
+    value = check;
+  }
+  return value;
+}
+
+// status registers (0x30..0x3D) are read with the burst bit set
+byte Ansulta::ReadStatus(byte addr)
+{
+  digitalWrite(SS,LOW);
+  while (digitalRead(MISO) == HIGH) {
+    };
+  SPI.transfer(addr | 0xC0);
+  byte y = SPI.transfer(0);
+  digitalWrite(SS,HIGH);
+  return y;
+}
+
 void Ansulta::SendStrobe(byte strobe, unsigned int delay_after)
 {
   digitalWrite(SS, LOW);
@@ -310,44 +496,138 @@ void Ansulta::SendStrobe(byte strobe, unsigned int delay_after)
   delayMicroseconds(delay_after);
 }
 
-void Ansulta::SendCommand(byte AddressByteA, byte AddressByteB, byte Command, int count)
+void Ansulta::queue_command(byte command, int count)
+{
+  if (p_tx_pending) {
+    METRIC_INC(radio_tx_replaced);
+  }
+  p_tx_pending = true;
+  p_tx_command = command;
+  p_tx_count = count;
+  p_tx_backoffs = 0;
+  p_tx_queued_ms = millis();
+  // on a clear channel the command is sent right away
+  process_tx();
+}
+
+void Ansulta::process_tx()
 {
-    DEBUG_PRINT("Ansulta: Send command ");
-    DEBUG_FPRINT(Command, HEX);
-    DEBUG_PRINT(" to ");
-    if (AddressByteA < 0x10) { DEBUG_PRINT("0"); }  //Print leading zero
-    DEBUG_FPRINT(AddressByteA, HEX);
-    if (AddressByteB < 0x10) { DEBUG_PRINT("0"); }
-    DEBUG_FPRINT(AddressByteB, HEX);
+  if (!channel_clear()) {
+    if (p_tx_backoffs < TX_MAX_BACKOFFS) {
+      p_tx_backoffs++;
+      METRIC_INC(radio_tx_backoffs);
+      TRACE_EVENT(TRACE_TX_BACKOFF, p_tx_command, p_tx_backoffs);
+      p_tx_due_ms = millis() + random(1, (1 << p_tx_backoffs) + 1) * TX_BACKOFF_SLOT_MS;
+      return;
+    }
+    DEBUG_PRINTLN("Ansulta: channel busy, sending anyway");
+    METRIC_INC(radio_tx_forced);
+  }
+  p_tx_pending = false;
+  METRIC_ADD(radio_tx_delay_ms, millis() - p_tx_queued_ms);
+  SendCommand(AddressByteA, AddressByteB, p_tx_command, p_tx_count);
+}
+
+// the radio listens between the commands (read_cmd), the CCA is read without leaving RX
+bool Ansulta::channel_clear()
+{
+  if ((ReadStatus(REG_MARCSTATE) & 0x1F) != MARCSTATE_RX) {
+    // takes the frames left in the FIFO and restarts RX
+    read_cmd();
+    delayMicroseconds(TX_CCA_SETTLE_US);
+  }
+  return ReadStatus(REG_PKTSTATUS) & PKTSTATUS_CCA;
+}
 
+void Ansulta::SendCommand(byte AddressByteA, byte AddressByteB, byte Command, int count)
+{
+    TRACE_EVENT(TRACE_TX_BURST, Command, count);
+    METRIC_INC(radio_tx_bursts);
+#ifdef TX_PER_PACKET
+    TxFrames& frames = get_tx_frames(AddressByteA, AddressByteB, Command);
     for (byte i = 0; i < count; i++) {       //Send 50 times
-      DEBUG_PRINT("~");
+      TRACE_EVENT(TRACE_TX_PACKET, i, 0);
+      METRIC_INC(radio_tx_packets);
       SendStrobe(CC2500_SIDLE, delayB);   //0x36 SIDLE Exit RX / TX, turn off frequency synthesizer and exit Wake-On-Radio mode if applicable.
       SendStrobe(CC2500_SFTX, delayB);    //0x3B SFTX Flush the TX FIFO buffer. Only issue SFTX in IDLE or TXFIFO_UNDERFLOW states.
-      digitalWrite(SS,LOW);
-      while (digitalRead(MISO) == HIGH) { };  //Wait untill MISO high
-      SPI.transfer(0x7F);
-      delayMicroseconds(delayA);
-      SPI.transfer(0x06);
-      delayMicroseconds(delayA);
-      SPI.transfer(0x55);
-      delayMicroseconds(delayA);
-      SPI.transfer(0x01);                 
-      delayMicroseconds(delayA);
-      SPI.transfer(AddressByteA);                 //Address Byte A
-      delayMicroseconds(delayA);
-      SPI.transfer(AddressByteB);                 //Address Byte B
-      delayMicroseconds(delayA);
-      SPI.transfer(Command);                      //Command 0x01=Light OFF 0x02=50% 0x03=100% 0xFF=Pairing
-      delayMicroseconds(delayA);
-      SPI.transfer(0xAA);
-      delayMicroseconds(delayA);
-      SPI.transfer(0xFF);
-      digitalWrite(SS,HIGH);
+      WriteFrames(frames, 1);
       SendStrobe(CC2500_STX, delayB);                 //0x35 STX In IDLE state: Enable TX. Perform calibration first if MCSM0.FS_AUTOCAL=1. If in RX state and CCA is enabled: Only go to TX if channel is clear
       delayMicroseconds(delayC);      //Longer delay for transmitting
     }
-    DEBUG_PRINTLN(" - Done");
+#else
+    TxFrames& frames = get_tx_frames(AddressByteA, AddressByteB, Command);
+    SendStrobe(CC2500_SIDLE, 0);
+    SendStrobe(CC2500_SFTX, 0);
+    WriteReg(REG_MCSM1, MCSM1_TXOFF_TX);
+    // preload as many frames as fit into the FIFO, the radio sends them without further strobes
+    int queued = min(count, TX_PRELOAD_FRAMES);
+    WriteFrames(frames, queued);
+    SendStrobe(CC2500_STX, 0);
+    unsigned long start_us = micros();
+    unsigned long timeout_us = (unsigned long)count * TX_PACKET_TIMEOUT_US;
+    while (true) {
+      byte txbytes = ReadFifoBytes(REG_TXBYTES);
+      if (txbytes & 0x80) {
+        DEBUG_PRINTLN("Ansulta: TX FIFO underflow");
+        break;
+      }
+      if (queued < count) {
+        // refill a frame as soon as there is space for it
+        if (txbytes + TX_FRAME_SIZE <= TX_FIFO_SIZE) {
+          WriteFrames(frames, 1);
+          queued++;
+        }
+      } else if (txbytes == 0) {
+        // read after the last refill, all frames are on air
+        break;
+      }
+      if (micros() - start_us > timeout_us) {
+        DEBUG_PRINTLN("Ansulta: TX timed out");
+        break;
+      }
+    }
+    delayMicroseconds(TX_TAIL_US);
+    // leave the preamble of TXOFF_MODE=TX and drop what is left after an error
+    SendStrobe(CC2500_SIDLE, 0);
+    SendStrobe(CC2500_SFTX, 0);
+    WriteReg(REG_MCSM1, MCSM1_RXOFF_RX);
+    METRIC_ADD(radio_tx_packets, queued);
+#endif
+    TRACE_EVENT(TRACE_TX_DONE, Command, 0);
+}
+
+
+// the frames are built once per address and command
+TxFrames& Ansulta::get_tx_frames(byte addr_a, byte addr_b, byte command)
+{
+  for (int i = 0; i < TX_FRAME_CACHE_SIZE; i++) {
+    TxFrames& frames = p_tx_frames[i];
+    if (frames.valid && frames.address_a == addr_a && frames.address_b == addr_b && frames.command == command) {
+      return frames;
+    }
+  }
+  TxFrames& frames = p_tx_frames[p_tx_frames_next];
+  p_tx_frames_next = (p_tx_frames_next + 1) % TX_FRAME_CACHE_SIZE;
+  const byte frame[TX_FRAME_SIZE] = { 0x06, 0x55, 0x01, addr_a, addr_b, command, 0xAA };
+  frames.bytes[0] = CC2500_FIFO | 0x40;  // burst write of the TX FIFO
+  for (int i = 0; i < TX_PRELOAD_FRAMES; i++) {
+    memcpy(&frames.bytes[1 + i * TX_FRAME_SIZE], frame, TX_FRAME_SIZE);
+  }
+  frames.address_a = addr_a;
+  frames.address_b = addr_b;
+  frames.command = command;
+  frames.valid = true;
+  return frames;
+}
+
+// writes count (up to TX_PRELOAD_FRAMES) frames in one chip select, the SPI hardware streams the buffer
+void Ansulta::WriteFrames(TxFrames& frames, int count)
+{
+  digitalWrite(SS,LOW);
+  while (digitalRead(MISO) == HIGH) {
+    };
+  SPI.writeBytes(frames.bytes, 1 + count * TX_FRAME_SIZE);
+  digitalWrite(SS,HIGH);
 }
 
 
@@ -19,7 +19,8 @@ https://github.com/NDBCK/Ansluta-Remote-Controller
 #include <SPI.h>
 #include "debug.h"
 
-#define MAX_LEARN_TRIES 10        // Tries to receive the code from ansulta remote
+#define LEARN_TIMEOUT_MS 40000    // Duration of a learning started by start_learning(), like the Hue light search
+#define LEARN_DEMO_STEP_MS 1000   // Pause between the commands of the demo sequence after an address was learned
 #define REPEATS         1         // Tries to receive the code from ansulta remote
 
 #define CC2500_SIDLE    0x36      // Exit RX / TX
@@ -29,6 +30,44 @@ https://github.com/NDBCK/Ansluta-Remote-Controller
 #define CC2500_FIFO     0x3F      // TX and RX FIFO
 #define CC2500_SRX      0x34      // Enable RX. Perform calibration if enabled
 #define CC2500_SFRX     0x3A      // Flush the RX FIFO buffer. Only issue SFRX in IDLE or RXFIFO_OVERFLOW states
+#define CC2500_SCAL     0x33      // Calibrate frequency synthesizer and turn it off
+
+// The synthesizer is calibrated once and then periodically instead of on each IDLE->TX/RX
+// (FS_AUTOCAL of MCSM0), which costs ~800us for each of the repeated packets of a command.
+#define MCSM0_MANUAL_CAL (VAL_MCSM0 & ~0x30)  // FS_AUTOCAL = 0, never calibrate automatically
+#define CAL_INTERVAL_MS  900000   // recalibration against temperature drift
+#define CAL_TIMEOUT_US   2000     // the calibration takes ~720us
+#define MARCSTATE_IDLE   0x01
+
+// The radio stays in RX after a frame (RXOFF_MODE of MCSM1), the RX FIFO collects the frames
+// between two calls of read_cmd(). The FIFO is read in one burst and its frames are decoded
+// in place by decode_frame(), the bytes of a frame in reception are kept for the next call.
+#define MCSM1_RXOFF_RX   (VAL_MCSM1 | 0x0C)
+#define MARCSTATE_RXFIFO_OVERFLOW 0x11
+#define RX_FIFO_SIZE     64
+#define RX_FRAME_MAX     (RX_FIFO_SIZE - 3)  // larger length bytes are noise, the frames can not be separated then
+#define RX_BUFFER_SIZE   (2 * RX_FIFO_SIZE)
+#define ANSULTA_FRAME_SIZE 6      // 0x55, 0x01, address A, address B, command, 0xAA
+
+// The repeated packets of a command are sent back to back: the radio stays in TX
+// after each packet (TXOFF_MODE of MCSM1) and the frames are refilled into the FIFO.
+#define MCSM1_TXOFF_TX   ((MCSM1_RXOFF_RX & ~0x03) | 0x02)
+#define TX_FRAME_SIZE    7        // length byte and the 6 bytes of the Ansulta frame
+#define TX_FIFO_SIZE     64
+#define TX_PACKET_TIMEOUT_US 2000 // a packet is ~0.6ms on air
+#define TX_TAIL_US       200      // CRC of the last packet after the FIFO is empty
+#define TX_PRELOAD_FRAMES (TX_FIFO_SIZE / TX_FRAME_SIZE)
+#define TX_FRAME_CACHE_SIZE 4     // off, 50%, 100% and pairing of one address
+
+// Listen before talk: a command is queued and sent when the CCA of the radio reports a
+// clear channel (CCA_MODE of MCSM1). The RSSI also covers the WiFi frames on the overlapping
+// channel, so the bursts are placed into the gaps of the WiFi traffic. On a busy channel
+// the command waits a random exponential backoff, serverLoop() tries again.
+#define MARCSTATE_RX     0x0D
+#define PKTSTATUS_CCA    0x10
+#define TX_CCA_SETTLE_US 300      // RX settling until the RSSI and so the CCA is valid
+#define TX_BACKOFF_SLOT_MS 2      // a WiFi frame at a low rate takes a few ms
+#define TX_MAX_BACKOFFS  6        // afterwards the command is sent on a busy channel
 
 #define Light_OFF       0x01      // Command to turn the light off
 #define Light_ON_50     0x02      // Command to turn the light on 50%
@@ -40,15 +79,49 @@ class AnsultaCallback {
     virtual void light_state_changed(int state, bool by_ansulta_ctrl);
 };
 
+enum AnsultaFrameType {
+  FRAME_INCOMPLETE,  // more bytes are needed
+  FRAME_COMMAND,     // command of an Ansulta remote
+  FRAME_REJECTED,    // complete frame, but no Ansulta command
+  FRAME_INVALID      // length byte beyond RX_FRAME_MAX, the following bytes can not be decoded
+};
+
+// frame of the RX FIFO: the length byte, the payload and the RSSI and LQI/CRC_OK status bytes
+struct AnsultaFrame {
+    AnsultaFrameType type;
+    byte length;       // bytes of the frame in the FIFO, status bytes included
+    byte address_a;    // address and command only for FRAME_COMMAND
+    byte address_b;
+    byte command;
+    byte rssi;
+    byte lqi;
+};
+
+// Ready to send FIFO burst write of a command: the burst header followed by
+// TX_PRELOAD_FRAMES copies of the frame, so a preload or a refill is a single SPI write.
+struct TxFrames {
+    bool valid;
+    byte address_a;
+    byte address_b;
+    byte command;
+    byte bytes[1 + TX_PRELOAD_FRAMES * TX_FRAME_SIZE];
+};
+
 class Ansulta {
 public:
     static const byte OFF = 0x01;
     static const byte ON_50 = 0x02;
     static const byte ON_100 = 0x03;
+    // states of the address learning
+    static const byte LEARN_IDLE = 0;
+    static const byte LEARN_LISTENING = 1;  // the next Ansulta remote frame sets the address
+    static const byte LEARN_FOUND = 2;      // the last learning found an address
 
     Ansulta();
     ~Ansulta();
     void init();
+    // calibrates the frequency synthesizer now, done by init() and every CAL_INTERVAL_MS
+    void calibrate();
     void serverLoop();
     void add_handler(AnsultaCallback *handler);
     bool valid_address();
@@ -60,13 +133,19 @@ public:
     int get_brightness();
     byte get_address_a();
     byte get_address_b();
+    // learning does not block, the frames are taken from the normal reception in serverLoop()
+    // timeout_ms 0 listens until an address is found
+    void start_learning(unsigned long timeout_ms=LEARN_TIMEOUT_MS);
+    void stop_learning();
+    byte get_learn_state();
+    // learning started with a timeout, not the listening without an address
+    bool is_searching();
+    // decodes the frame at the start of data, reads only the first size bytes
+    static AnsultaFrameType decode_frame(const byte *data, int size, AnsultaFrame& frame);
 
 private:
     std::vector<AnsultaCallback *> p_ansulta_handler;
     bool p_address_found;
-    bool p_first_info;
-    int p_count_c;
-    byte delayA;
     unsigned int delayB;
     byte delayC;
     byte delayD;
@@ -78,13 +157,48 @@ private:
     byte p_led_state;
 
     int p_count_repeats;
+    // synthesizer calibration of the channel, restored after a reset of the chip
+    // (the Ansulta lights use only VAL_CHANNR, so one entry is enough)
+    bool p_cal_valid;
+    byte p_cal_channel;
+    byte p_cal_fscal3;
+    byte p_cal_fscal2;
+    byte p_cal_fscal1;
+    unsigned long p_cal_ms;
+    byte p_rx_buffer[RX_BUFFER_SIZE];  // FIFO bytes not yet decoded, starts with a length byte
+    int p_rx_fill;
+    TxFrames p_tx_frames[TX_FRAME_CACHE_SIZE];
+    byte p_tx_frames_next;       // entry replaced by the next miss
     unsigned long p_off_last_cmd_ms;
+    // command waiting for a clear channel, a newer command replaces it
+    bool p_tx_pending;
+    byte p_tx_command;
+    int p_tx_count;
+    byte p_tx_backoffs;
+    unsigned long p_tx_due_ms;
+    unsigned long p_tx_queued_ms;
+    byte p_learn_state;
+    unsigned long p_learn_start_ms;
+    unsigned long p_learn_timeout_ms;
+    byte p_demo_step;            // next command of the demo sequence, 0 if not running
+    unsigned long p_demo_last_ms;
 
     void inform_handler(int state, bool by_ansulta_ctrl);
     void read_cmd();
-    void ReadAddressBytes();
+    int rx_missing();
+    void handle_frame(const byte *data, const AnsultaFrame& frame);
+    void learn_address(byte addr_a, byte addr_b, byte state);
+    void demo_step();
     byte ReadReg(byte addr);
+    byte ReadStatus(byte addr);
+    byte ReadFifoBytes(byte addr);
+    void ReadBurst(byte addr, byte *buffer, int count);
+    TxFrames& get_tx_frames(byte addr_a, byte addr_b, byte command);
+    void WriteFrames(TxFrames& frames, int count);
     void SendStrobe(byte strobe, unsigned int delay_after=200);
+    void queue_command(byte command, int count);
+    void process_tx();
+    bool channel_clear();
     void SendCommand(byte AddressByteA, byte AddressByteB, byte Command, int count=10);
     void WriteReg(byte addr, byte value);
     void init_CC2500();
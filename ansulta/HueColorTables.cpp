@@ -0,0 +1,53 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Lookup tables for the color conversions of the Hue emulation.
+The tables are generated by the compiler and stored in flash,
+so the request path does not need the slow software float
+log() and pow() on the ESP8266.
+
+**************************************************************/
+#include "HueColorTables.h"
+
+using namespace hue;
+
+// red is always saturated in the valid mirek range, only green and blue are stored
+static const MirekTable MIREK_TABLE PROGMEM = makeMirekTable(ctmath::genseq<HECTEMP_COUNT>());
+static const GammaTable GAMMA_TABLE PROGMEM = makeGammaTable(ctmath::genseq<GAMMA_TABLE_SIZE>());
+
+rgbcolor hue::mirekToRGB(int mirek)
+{
+  if (mirek < MIREK_MIN) {
+    mirek = MIREK_MIN;
+  } else if (mirek > MIREK_MAX) {
+    mirek = MIREK_MAX;
+  }
+  // the hecto kelvin are integral, so each mirek maps exactly to one table entry
+  int index = 10000 / mirek - HECTEMP_MIN;
+  return rgbcolor(255,
+                  pgm_read_byte(&MIREK_TABLE.green[index]),
+                  pgm_read_byte(&MIREK_TABLE.blue[index]));
+}
+
+float hue::gammaCorrect(float linear)
+{
+  if (linear <= 0.0f) {
+    // negative values are clamped by the caller, keep the linear part of sRGB
+    return 12.92f * linear;
+  }
+  if (linear >= 1.0f) {
+    return 1.0f;
+  }
+  uint32_t q = (uint32_t)(linear * 65536.0f);
+  uint32_t index = q >> (16 - GAMMA_TABLE_BITS);
+  uint32_t frac = q & ((1 << (16 - GAMMA_TABLE_BITS)) - 1);
+  uint32_t a = pgm_read_word(&GAMMA_TABLE.value[index]);
+  uint32_t b = pgm_read_word(&GAMMA_TABLE.value[index + 1]);
+  uint32_t value = a + (((b - a) * frac) >> (16 - GAMMA_TABLE_BITS));
+  return value / 65535.0f;
+}
@@ -0,0 +1,121 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Lookup tables for the color conversions of the Hue emulation.
+The tables are generated by the compiler and stored in flash,
+so the request path does not need the slow software float
+log() and pow() on the ESP8266.
+
+**************************************************************/
+#ifndef HUECOLORTABLES_H
+#define HUECOLORTABLES_H
+
+#include <Arduino.h>
+#include "HueTypes.h"
+
+namespace hue {
+
+// valid range for the Hue "ct" value
+#define MIREK_MIN 153
+#define MIREK_MAX 500
+// getMirektoRGB() works with the temperature in hundreds of kelvin
+#define HECTEMP_MIN (10000 / MIREK_MAX)
+#define HECTEMP_MAX (10000 / MIREK_MIN)
+#define HECTEMP_COUNT (HECTEMP_MAX - HECTEMP_MIN + 1)
+// sRGB gamma table: 256 intervals over the linear range [0, 1]
+#define GAMMA_TABLE_BITS 8
+#define GAMMA_TABLE_SIZE ((1 << GAMMA_TABLE_BITS) + 1)
+
+// ==============================================================================================================
+// C++11 constexpr math, only used to generate the tables at compile time
+// ==============================================================================================================
+namespace ctmath {
+
+constexpr double LN2 = 0.69314718055994530942;
+
+constexpr double square(double x) {
+  return x * x;
+}
+
+// 2 * atanh(s) series, converges fast for s in [0, 1/3]
+constexpr double atanhSeries(double s, double s2, double term, int n) {
+  return n > 41 ? 0.0 : term / n + atanhSeries(s, s2, term * s2, n + 2);
+}
+
+// natural logarithm, the argument is reduced to [1, 2)
+constexpr double log(double x) {
+  return x >= 2.0 ? log(x / 2.0) + LN2
+       : x < 1.0 ? log(x * 2.0) - LN2
+       : 2.0 * atanhSeries((x - 1.0) / (x + 1.0), square((x - 1.0) / (x + 1.0)), (x - 1.0) / (x + 1.0), 1);
+}
+
+constexpr double expSeries(double x, double term, int n) {
+  return n > 20 ? term : term + expSeries(x, term * x / n, n + 1);
+}
+
+// exponential function, the argument is halved until it is small
+constexpr double exp(double x) {
+  return (x > 0.5 || x < -0.5) ? square(exp(x / 2.0)) : expSeries(x, 1.0, 1);
+}
+
+constexpr double pow(double x, double y) {
+  return x <= 0.0 ? 0.0 : exp(y * log(x));
+}
+
+constexpr uint8_t clampColor(double value) {
+  return value <= 0.0 ? 0 : value >= 255.0 ? 255 : (uint8_t)(int)value;
+}
+
+// same formulas as used in getMirektoRGB() before the tables were introduced
+constexpr uint8_t mirekGreen(int hectemp) {
+  return clampColor(99.4708025861 * log(hectemp) - 161.1195681661);
+}
+
+constexpr uint8_t mirekBlue(int hectemp) {
+  return hectemp <= 19 ? 0 : clampColor(138.5177312231 * log(hectemp - 10) - 305.0447927307);
+}
+
+// sRGB gamma in 16 bit fixed point
+constexpr uint16_t gamma(double linear) {
+  return (uint16_t)((linear <= 0.0031308 ? 12.92 * linear : 1.055 * pow(linear, 1.0 / 2.4) - 0.055) * 65535.0 + 0.5);
+}
+
+// index sequence, std::index_sequence is not available in C++11
+template<int... I> struct seq {};
+template<int N, int... I> struct genseq : genseq<N - 1, N - 1, I...> {};
+template<int... I> struct genseq<0, I...> : seq<I...> {};
+
+}  // namespace ctmath
+
+struct MirekTable {
+  uint8_t green[HECTEMP_COUNT];
+  uint8_t blue[HECTEMP_COUNT];
+};
+
+struct GammaTable {
+  uint16_t value[GAMMA_TABLE_SIZE];
+};
+
+template<int... I>
+constexpr MirekTable makeMirekTable(ctmath::seq<I...>) {
+  return MirekTable{ { ctmath::mirekGreen(HECTEMP_MIN + I)... }, { ctmath::mirekBlue(HECTEMP_MIN + I)... } };
+}
+
+template<int... I>
+constexpr GammaTable makeGammaTable(ctmath::seq<I...>) {
+  return GammaTable{ { ctmath::gamma((double)I / (1 << GAMMA_TABLE_BITS))... } };
+}
+
+/** Returns the color for a Hue color temperature in mirek. The value is clamped to 153..500. */
+rgbcolor mirekToRGB(int mirek);
+
+/** Applies the sRGB gamma correction to a linear value in [0, 1], interpolating the table. */
+float gammaCorrect(float linear);
+
+};
+#endif
@@ -0,0 +1,79 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Compact form of a Hue API command as used by schedules and rules.
+
+**************************************************************/
+#include "HueLightAction.h"
+
+using namespace hue;
+
+bool hue::parseLightAction(JsonObject& command, LightAction& action)
+{
+    memset(&action, 0, sizeof(action));
+    const char *address = command["address"];
+    JsonObject& body = command["body"];
+    if (!address || !body.success()) {
+        return false;
+    }
+    // "/api/<user>/lights/<id>/state" or "/api/<user>/groups/<id>/action"
+    const char *target = strstr(address, "/lights/");
+    if (target) {
+        action.target = ACTION_TARGET_LIGHT;
+        target += strlen("/lights/");
+    } else if ((target = strstr(address, "/groups/")) != NULL) {
+        action.target = ACTION_TARGET_GROUP;
+        target += strlen("/groups/");
+    } else {
+        return false;
+    }
+    int id = atoi(target);
+    if (id < 0 || id > 255 || (id == 0 && action.target == ACTION_TARGET_LIGHT)) {
+        return false;
+    }
+    action.id = id;
+    if (body.containsKey("on")) {
+        action.fields |= ACTION_ON;
+        action.on = body["on"].as<bool>();
+    }
+    if (body.containsKey("bri")) {
+        action.fields |= ACTION_BRI;
+        action.bri = constrain(body["bri"].as<int>(), 1, 254);
+    }
+    if (body.containsKey("hue")) {
+        action.fields |= ACTION_HUE;
+        action.hue = constrain(body["hue"].as<long>(), 0L, 65535L);
+    }
+    if (body.containsKey("sat")) {
+        action.fields |= ACTION_SAT;
+        action.sat = constrain(body["sat"].as<int>(), 0, 254);
+    }
+    if (body.containsKey("transitiontime")) {
+        action.fields |= ACTION_TRANSITION;
+        action.transitionTime = constrain(body["transitiontime"].as<long>(), 0L, 65535L);
+    }
+    return action.fields != 0;
+}
+
+void hue::fillLightActionJson(const LightAction& action, JsonObject& command)
+{
+    char address[32];
+    if (action.target == ACTION_TARGET_LIGHT) {
+        snprintf_P(address, sizeof(address), PSTR("/api/api/lights/%u/state"), action.id);
+    } else {
+        snprintf_P(address, sizeof(address), PSTR("/api/api/groups/%u/action"), action.id);
+    }
+    command["address"] = address;  // char* is copied into the buffer
+    command["method"] = "PUT";
+    JsonObject& body = command.createNestedObject("body");
+    if (action.fields & ACTION_ON) body["on"] = action.on != 0;
+    if (action.fields & ACTION_BRI) body["bri"] = action.bri;
+    if (action.fields & ACTION_HUE) body["hue"] = action.hue;
+    if (action.fields & ACTION_SAT) body["sat"] = action.sat;
+    if (action.fields & ACTION_TRANSITION) body["transitiontime"] = action.transitionTime;
+}
@@ -0,0 +1,63 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Compact form of a Hue API command ("address", "method", "body")
+as used by schedules and rules. Only light state and group
+action commands are supported.
+
+**************************************************************/
+#ifndef HUELIGHTACTION_H
+#define HUELIGHTACTION_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include "HueTypes.h"
+
+namespace hue {
+
+#define ACTION_TARGET_LIGHT 0  // /lights/<id>/state
+#define ACTION_TARGET_GROUP 1  // /groups/<id>/action, group 0 contains all lights
+
+// fields of the body set in the action
+#define ACTION_ON         0x01
+#define ACTION_BRI        0x02
+#define ACTION_HUE        0x04
+#define ACTION_SAT        0x08
+#define ACTION_TRANSITION 0x10
+
+struct LightAction {
+  uint8_t target;
+  uint8_t id;
+  uint8_t fields;
+  uint8_t on;
+  uint8_t bri;
+  uint8_t sat;
+  uint16_t hue;
+  uint16_t transitionTime;
+
+  // copies the fields set in the action into the light state
+  void applyTo(LightInfo& info) const {
+    if (fields & ACTION_ON) info.on = on;
+    if (fields & ACTION_BRI) info.brightness = bri;
+    if (fields & ACTION_HUE) info.hue = hue;
+    if (fields & ACTION_SAT) info.saturation = sat;
+    if (fields & ACTION_TRANSITION) info.transitionTime = transitionTime;
+  }
+} __attribute__((packed));
+
+// executes an action, implemented by the LightServiceClass
+typedef std::function<void(const LightAction&)> ActionFunction;
+
+/** Parses a Hue command object, returns false if the address or body is not supported. */
+bool parseLightAction(JsonObject& command, LightAction& action);
+/** Fills the "address", "method" and "body" of a Hue command object. */
+void fillLightActionJson(const LightAction& action, JsonObject& command);
+
+};
+#endif
@@ -17,30 +17,67 @@ https://github.com/probonopd/ESP8266HueEmulator
 
 using namespace hue;
 
-LightGroup::LightGroup(JsonObject& root)
+LightGroup::LightGroup()
 {
-    String tmpName = root["name"];
-    this->name = tmpName;
+    name[0] = '\0';
+    id[0] = '\0';
+    memberCount = 0;
+    onCount = 0;
+    briSum = 0;
+    statesStart = -1;
+}
+
+void LightGroup::init(JsonObject& root)
+{
+    const char* tmpName = root["name"];
+    strlcpy(name, tmpName != nullptr ? tmpName : "", sizeof(name));
+    id[0] = '\0';
+    lights.clearAll();
     JsonArray& jLights = root["lights"];
     for (size_t i = 0; i < jLights.size(); i++) {
         // lights are 1-based and map to the 0-based bitfield
         int lightNum = jLights[i];
-        if (lightNum != 0) {
-            lights |= (1 << (lightNum - 1));
-        }
+        lights.set(lightNum - 1);
+    }
+    memberCount = lights.count();
+    onCount = 0;
+    briSum = 0;
+    statesStart = -1;
+}
+
+void LightGroup::initState(const LightInfo* states)
+{
+    onCount = 0;
+    briSum = 0;
+    for (int i = lights.first(); i >= 0; i = lights.next(i)) {
+        onCount += states[i].on;
+        briSum += states[i].brightness;
     }
 }
 
+void LightGroup::memberChanged(const LightInfo& oldInfo, const LightInfo& newInfo)
+{
+    onCount = onCount - oldInfo.on + newInfo.on;
+    briSum = briSum - oldInfo.brightness + newInfo.brightness;
+}
+
+// "state" and "action" of a group, the action reports the average brightness
+void LightGroup::fillStateJson(JsonObject& root, int members, int onCount, uint32_t briSum)
+{
+    JsonObject& state = root.createNestedObject("state");
+    state["all_on"] = members > 0 && onCount == members;
+    state["any_on"] = onCount > 0;
+    JsonObject& action = root.createNestedObject("action");
+    action["on"] = onCount > 0;
+    action["bri"] = members > 0 ? briSum / members : 0;
+    action["alert"] = "none";
+}
+
 bool LightGroup::fillJson(JsonObject& root) {
     root["name"] = name;
-    JsonObject& state = root.createNestedObject("state");
-    state["all_on"] = "true";
-    state["any_on"] = "true";
+    fillStateJson(root, memberCount, onCount, briSum);
     JsonArray& data = root.createNestedArray("lights");
-    for (int i = 0; i < 16; i++) {
-        if (!((1 << i) & lights)) {
-            continue;
-        }
+    for (int i = lights.first(); i >= 0; i = lights.next(i)) {
         // add light to list
         String lightNum = "";
         lightNum += (i + 1);
@@ -51,13 +88,10 @@ bool LightGroup::fillJson(JsonObject& root) {
 }
 
 
-bool LightGroup::fillSceneJson(JsonObject& root, bool withStates, LightServiceInterface* lightService) {
+bool LightGroup::fillSceneJson(JsonObject& root, const LightInfo* states) {
     root["name"] = name;
     JsonArray& jlights = root.createNestedArray("lights");
-    for (int i = 0; i < 16; i++) {
-        if (!((1 << i) & lights)) {
-            continue;
-        }
+    for (int i = lights.first(); i >= 0; i = lights.next(i)) {
         // add light to list
         String lightNum = "";
         lightNum += (i + 1);
@@ -73,26 +107,24 @@ bool LightGroup::fillSceneJson(JsonObject& root, bool withStates, LightServiceIn
     root["lastupdated"] = "2017-11-04T10:17:15";
     root["version"] = 2;
 
-    if(withStates==true && lightService)
+    if (states)
     {
       DEBUG_PRINTLN("Adding lightstates");
       JsonObject& lightstates = root.createNestedObject("lightstates");
-      for (int i = 0; i < 16; i++) {
-        if (!((1 << i) & lights)) {
-          continue;
-        }        
+      int rank = 0;
+      for (int i = lights.first(); i >= 0; i = lights.next(i)) {
         // add light to list
         String lightNum = "";
         lightNum += (i + 1);
-        LightHandler *handler = lightService->getLightHandler(i);
-        LightInfo currentInfo = handler->getInfo(i);
+        const LightInfo& targetInfo = states[rank++];
         JsonObject& lightState = lightstates.createNestedObject(lightNum);
-        lightState["on"] = currentInfo.on;
-        lightState["bri"] = currentInfo.brightness;
-        JsonArray& xy = lightState.createNestedArray("xy");
-        xy.add(0.5806);
-        xy.add(0.3903);
-      }        
+        lightState["on"] = targetInfo.on;
+        lightState["bri"] = targetInfo.brightness;
+        if (targetInfo.getBulbType() == BulbType::EXTENDED_COLOR_LIGHT) {
+          lightState["hue"] = targetInfo.hue;
+          lightState["sat"] = targetInfo.saturation;
+        }
+      }
     }
 
     //String output;
@@ -101,13 +133,33 @@ bool LightGroup::fillSceneJson(JsonObject& root, bool withStates, LightServiceIn
     return root.success();
 }
 
-unsigned int LightGroup::getLightMask()
+const LightMask& LightGroup::getLightMask()
 {
   return lights;
 }
 
-String LightGroup::getName()
+const char* LightGroup::getName()
+{
+  return name;
+}
+
+const char* LightGroup::getId()
+{
+  return id;
+}
+
+void LightGroup::setId(const char* id)
+{
+  strlcpy(this->id, id, sizeof(this->id));
+}
+
+int LightGroup::getStatesStart()
+{
+  return statesStart;
+}
+
+void LightGroup::setStatesStart(int start)
 {
-  return name;  
+  statesStart = start;
 }
 
@@ -20,22 +20,91 @@ https://github.com/probonopd/ESP8266HueEmulator
 
 namespace hue {
 
+#define LIGHT_GROUP_NAME_SIZE 33  // Hue names have up to 32 characters
+#define LIGHT_GROUP_ID_SIZE 17    // Hue scene ids have up to 16 characters
+
 class LightGroup {
   public:
-    LightGroup(JsonObject& root);
+    LightGroup();
+    // (re)initializes a pooled record, see LightGroupPool
+    void init(JsonObject& root);
     bool fillJson(JsonObject& root);
-    bool fillSceneJson(JsonObject& root, bool withStates, LightServiceInterface* lightService);
-    unsigned int getLightMask();
+    // aggregate of the member lights, initialized from the cached states and
+    // updated in O(1) by the LightServiceClass on each change of a member
+    void initState(const LightInfo* states);
+    void memberChanged(const LightInfo& oldInfo, const LightInfo& newInfo);
+    static void fillStateJson(JsonObject& root, int members, int onCount, uint32_t briSum);
+    // states holds one entry per member light in the order of the light numbers,
+    // without states the lightstates are omitted
+    bool fillSceneJson(JsonObject& root, const LightInfo* states);
+    const LightMask& getLightMask();
     // only used for scenes
-    String id;
-    String getName();
+    const char* getId();
+    void setId(const char* id);
+    // first target state of the scene in the scene state store, -1 without states
+    int getStatesStart();
+    void setStatesStart(int start);
+    const char* getName();
 
   protected:
-    String name;
-    // use unsigned int to hold members of this group. 2 bytes -> supports up to 16 lights
-    unsigned int lights = 0;
+    char name[LIGHT_GROUP_NAME_SIZE];
+    char id[LIGHT_GROUP_ID_SIZE];
+    // members of this group, supports up to MAX_LIGHT_HANDLERS lights
+    LightMask lights;
+    uint8_t memberCount;
+    uint8_t onCount;
+    uint16_t briSum;  // up to MAX_LIGHT_HANDLERS * 254
+    int16_t statesStart;
     // no need to hold the group type, only LightGroup is supported for API 1.4
 };
 
+// Statically sized pool of group and scene records. Scene churn from the
+// Hue app allocates and frees records in O(1) without touching the heap.
+template<int N>
+class LightGroupPool {
+  static_assert(N > 0 && N <= 32767, "the free list uses int16_t indices");
+  public:
+    LightGroupPool() {
+        for (int i = 0; i < N; i++) {
+            pNextFree[i] = i + 1;
+        }
+        pNextFree[N - 1] = -1;
+        pFreeHead = 0;
+        pAvailable = N;
+    }
+
+    // returns nullptr if the pool is exhausted
+    LightGroup* allocate(JsonObject& root) {
+        if (pFreeHead == -1) {
+            return nullptr;
+        }
+        int index = pFreeHead;
+        pFreeHead = pNextFree[index];
+        pAvailable--;
+        pRecords[index].init(root);
+        return &pRecords[index];
+    }
+
+    void release(LightGroup* group) {
+        if (group == nullptr) {
+            return;
+        }
+        int index = group - pRecords;
+        pNextFree[index] = pFreeHead;
+        pFreeHead = index;
+        pAvailable++;
+    }
+
+    int available() {
+        return pAvailable;
+    }
+
+  protected:
+    LightGroup pRecords[N];
+    int16_t pNextFree[N];
+    int16_t pFreeHead;
+    int pAvailable;
+};
+
 };
 #endif
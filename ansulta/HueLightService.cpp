@@ -16,11 +16,16 @@ https://github.com/probonopd/ESP8266HueEmulator
 #include <ESP8266WiFi.h>
 #include "HueWcFnRequestHandler.h"
 #include "HueTemplates.h"
+#include "HueColorTables.h"
+#include "HueRequestArena.h"
 
 #include <time.h>                       // time() ctime()
 #include <sys/time.h>                   // struct timeval
 #include <WiFiUdp.h>
 #include "SSDP.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
 #include <ArduinoJson.h>
 #include <FS.h>
 
@@ -30,6 +35,12 @@ using namespace hue;
 LightHandler* LightServiceClass::pLightHandlers[MAX_LIGHT_HANDLERS] = {}; // interfaces exposed to the outside world
 LightGroup* LightServiceClass::pLightGroups[MAX_LIGHT_GROUPS] = {nullptr, };
 LightGroup* LightServiceClass::pLightScenes[MAX_LIGHT_GROUPS] = {nullptr, };
+LightGroupPool<2 * MAX_LIGHT_GROUPS> LightServiceClass::pGroupPool;
+LightInfo LightServiceClass::pLightStates[MAX_LIGHT_HANDLERS];
+LightInfo LightServiceClass::pSceneStates[MAX_SCENE_LIGHT_STATES];
+int LightServiceClass::pSceneStatesUsed = 0;
+uint32_t LightServiceClass::pLightVersions[MAX_LIGHT_HANDLERS] = {};
+GroupMask LightServiceClass::pLightMemberships[MAX_LIGHT_HANDLERS];
 
 
 LightServiceClass::LightServiceClass(int numberOfLights)
@@ -39,6 +50,19 @@ LightServiceClass::LightServiceClass(int numberOfLights)
       pCurrentNumLights = numberOfLights;
     }
     HTTP = NULL;
+    pStateVersion = 0;
+    pSearchActive = false;
+    pLastScan = 0;
+    pSearchStartMs = 0;
+    pAllCount = 0;
+    pAllOnCount = 0;
+    pAllBriSum = 0;
+    pEventVersion = 0;
+    pSensorVersion = 0;
+    pSensorEventVersion = 0;
+    pRulesVersion = 0;
+    pRulesSensorVersion = 0;
+    pEventKeepaliveMs = 0;
 }
 
 LightServiceClass::~LightServiceClass() {
@@ -51,9 +75,110 @@ LightServiceClass::~LightServiceClass() {
 bool LightServiceClass::setLightHandler(int index, LightHandler& handler) {
   if (index >= pCurrentNumLights || index < 0) return false;
   pLightHandlers[index] = &handler;
+  // seed the cache, later changes are pushed by the handler
+  notifyLightState(index, handler.getInfo(index));
   return true;
 }
 
+void LightServiceClass::notifyLightState(int numberOfTheLight, const LightInfo& info)
+{
+  if (numberOfTheLight < 0 || numberOfTheLight >= MAX_LIGHT_HANDLERS) {
+    return;
+  }
+  bool seeded = pLightVersions[numberOfTheLight] != 0;
+  if (seeded && info.diff(pLightStates[numberOfTheLight]) == 0) {
+    return;
+  }
+  const LightInfo oldInfo = pLightStates[numberOfTheLight];
+  pLightStates[numberOfTheLight] = info;
+  pLightVersions[numberOfTheLight] = ++pStateVersion;
+  // the group aggregates only visit the groups of this light
+  const GroupMask& groups = pLightMemberships[numberOfTheLight];
+  for (int g = groups.first(); g >= 0; g = groups.next(g)) {
+    pLightGroups[g]->memberChanged(oldInfo, info);
+  }
+  if (seeded) {
+    pAllOnCount -= oldInfo.on;
+    pAllBriSum -= oldInfo.brightness;
+  } else {
+    pAllCount++;
+  }
+  pAllOnCount += info.on;
+  pAllBriSum += info.brightness;
+}
+
+const LightInfo& LightServiceClass::getLightState(int numberOfTheLight)
+{
+  if (numberOfTheLight < 0 || numberOfTheLight >= MAX_LIGHT_HANDLERS) {
+    return pLightStates[0];
+  }
+  return pLightStates[numberOfTheLight];
+}
+
+uint32_t LightServiceClass::getStateVersion()
+{
+  return pStateVersion;
+}
+
+bool LightServiceClass::applyLightState(int numberOfTheLight, const LightInfo& newInfo, JsonObject& raw)
+{
+  LightHandler *handler = getLightHandler(numberOfTheLight);
+  if (!handler) {
+    return false;
+  }
+  handler->handleQuery(numberOfTheLight, newInfo, raw);
+  return true;
+}
+
+void LightServiceClass::applyAction(const LightAction& action)
+{
+  LightMask lights;
+  if (action.target == ACTION_TARGET_LIGHT) {
+    lights.set(action.id - 1);
+  } else if (action.id == 0) {
+    lights.setAll();
+  } else if (action.id <= MAX_LIGHT_GROUPS && pLightGroups[action.id - 1]) {
+    lights = pLightGroups[action.id - 1]->getLightMask();
+  }
+  for (int i = lights.first(); i >= 0 && i < getLightsAvailable(); i = lights.next(i)) {
+    LightInfo newInfo = pLightStates[i];
+    action.applyTo(newInfo);
+    applyLightState(i, newInfo, JsonObject::invalid());
+  }
+}
+
+void LightServiceClass::setUdpToken(uint32_t token)
+{
+  pUdpControl.setToken(token);
+}
+
+void LightServiceClass::notifySensorState(const SensorState& state)
+{
+  pSensorState = state;
+  pSensorVersion++;
+}
+
+const SensorState& LightServiceClass::getSensorState()
+{
+  return pSensorState;
+}
+
+uint32_t LightServiceClass::getSensorVersion()
+{
+  return pSensorVersion;
+}
+
+LightMask LightServiceClass::changedSince(uint32_t version)
+{
+  LightMask result;
+  for (int i = 0; i < pCurrentNumLights; i++) {
+    if (pLightVersions[i] > version) {
+      result.set(i);
+    }
+  }
+  return result;
+}
+
 bool LightServiceClass::setLightsAvailable(int lights) {
   if (lights <= MAX_LIGHT_HANDLERS) {
     pCurrentNumLights = lights;
@@ -83,15 +208,17 @@ void LightServiceClass::begin() {
     begin(new ESP8266WebServer(WEB_PORT));
 }
 
-String StringIPaddress(IPAddress myaddr)
+static void copyIPaddress(char *buffer, size_t size, IPAddress myaddr)
 {
-    String LocalIP = "";
-    for (int i = 0; i < 4; i++) {
-        LocalIP += String(myaddr[i]);
-        if (i < 3)
-            LocalIP += ".";
-    }
-    return LocalIP;
+    snprintf_P(buffer, size, PSTR("%u.%u.%u.%u"), myaddr[0], myaddr[1], myaddr[2], myaddr[3]);
+}
+
+// file name of a group or scene slot, the template is in flash
+static String slotFileName(PGM_P fileTemplate, int slot)
+{
+    char fileName[32];
+    snprintf_P(fileName, sizeof(fileName), fileTemplate, slot);
+    return String(fileName);
 }
 
 void LightServiceClass::begin(ESP8266WebServer *svr) {
@@ -101,30 +228,49 @@ void LightServiceClass::begin(ESP8266WebServer *svr) {
     init_groups = false;
   }
   HTTP = svr;
-  macString = WiFi.macAddress();
-  bridgeIDString = macString;
-  bridgeIDString.replace(":", "");
-  bridgeIDString = bridgeIDString.substring(0, 6) + "FFFE" + bridgeIDString.substring(6);
-  ipString = StringIPaddress(WiFi.localIP());
-  netmaskString = StringIPaddress(WiFi.subnetMask());
-  gatewayString = StringIPaddress(WiFi.gatewayIP());
+  strlcpy(pIdentity.mac, WiFi.macAddress().c_str(), sizeof(pIdentity.mac));
+  // bridge id: first half of the MAC, FFFE, second half of the MAC
+  int pos = 0;
+  for (const char *c = pIdentity.mac; *c != '\0' && pos < 16; c++) {
+    if (*c == ':') {
+      continue;
+    }
+    if (pos == 6) {
+      memcpy(pIdentity.bridgeID + pos, "FFFE", 4);
+      pos += 4;
+    }
+    pIdentity.bridgeID[pos++] = *c;
+  }
+  pIdentity.bridgeID[pos] = '\0';
+  copyIPaddress(pIdentity.ip, sizeof(pIdentity.ip), WiFi.localIP());
+  copyIPaddress(pIdentity.netmask, sizeof(pIdentity.netmask), WiFi.subnetMask());
+  copyIPaddress(pIdentity.gateway, sizeof(pIdentity.gateway), WiFi.gatewayIP());
 
   DEBUG_PRINT("Starting HTTP at ");
-  DEBUG_PRINT(ipString);
+  DEBUG_PRINT(pIdentity.ip);
   DEBUG_PRINT(":");
   DEBUG_PRINTLN(WEB_PORT);
 
-  HTTP->on("/index.html", HTTP_GET, std::bind(&LightServiceClass::indexPageFn, this));
-  HTTP->on("/cache/clear", HTTP_GET, std::bind(&LightServiceClass::cacheClearFn, this));
-  HTTP->on("/description.xml", HTTP_GET, std::bind(&LightServiceClass::descriptionFn, this));
+  on(std::bind(&LightServiceClass::indexPageFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/index.html", HTTP_GET);
+  on(std::bind(&LightServiceClass::cacheClearFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/cache/clear", HTTP_GET);
+  on(std::bind(&LightServiceClass::descriptionFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/description.xml", HTTP_GET);
+  HTTP->on("/metrics", HTTP_GET, std::bind(&LightServiceClass::metricsFn, this));
+  on(std::bind(&LightServiceClass::eventStreamFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/eventstream", HTTP_GET);
+  HTTP->on("/capture.pcap", HTTP_GET, std::bind(&LightServiceClass::captureFn, this));
+#ifdef TRACE
+  HTTP->on("/trace", HTTP_GET, std::bind(&LightServiceClass::traceFn, this));
+#endif
   on(std::bind(&LightServiceClass::configFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/config", HTTP_ANY);
   on(std::bind(&LightServiceClass::configFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/config", HTTP_GET);
   on(std::bind(&LightServiceClass::wholeConfigFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*", HTTP_GET);
   on(std::bind(&LightServiceClass::wholeConfigFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/", HTTP_GET);
   on(std::bind(&LightServiceClass::authFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api", HTTP_POST);
-  on(std::bind(&LightServiceClass::unimpFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/schedules", HTTP_GET);
-  on(std::bind(&LightServiceClass::unimpFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/rules", HTTP_GET);
-  on(std::bind(&LightServiceClass::unimpFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/sensors", HTTP_GET);
+  on(std::bind(&LightServiceClass::schedulesFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/schedules", HTTP_ANY);
+  on(std::bind(&LightServiceClass::schedulesIdFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/schedules/*", HTTP_ANY);
+  on(std::bind(&LightServiceClass::rulesFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/rules", HTTP_ANY);
+  on(std::bind(&LightServiceClass::rulesIdFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/rules/*", HTTP_ANY);
+  on(std::bind(&LightServiceClass::sensorsFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/sensors", HTTP_GET);
+  on(std::bind(&LightServiceClass::sensorsIdFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/sensors/*", HTTP_GET);
   on(std::bind(&LightServiceClass::scenesFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/scenes", HTTP_ANY);
   on(std::bind(&LightServiceClass::scenesIdFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/scenes/*", HTTP_ANY);
   on(std::bind(&LightServiceClass::scenesIdLightFn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), "/api/*/scenes/*/lightstates/*", HTTP_ANY);
@@ -139,7 +285,7 @@ void LightServiceClass::begin(ESP8266WebServer *svr) {
 
   HTTP->begin();
 
-  String serial = macString;
+  String serial = pIdentity.mac;
   serial.toLowerCase();
   
   DEBUG_PRINTLN("Starting SSDP...");
@@ -158,22 +304,165 @@ void LightServiceClass::begin(ESP8266WebServer *svr) {
   SSDP.setDeviceType("urn:schemas-upnp-org:device:basic:1");
   //SSDP.setMessageFormatCallback(ssdpMsgFormatCallback);
   SSDP.begin();
+  pUdpControl.begin(this);
   DEBUG_PRINTLN("SSDP Started");
   DEBUG_PRINTLN("FS Starting");
   SPIFFS.begin();
   if (init_groups) {
     initializeGroupSlots();
     initializeSceneSlots();
+    pSchedules.begin(std::bind(&LightServiceClass::applyAction, this, std::placeholders::_1));
+    pRules.begin(&pSensorState, pLightStates, std::bind(&LightServiceClass::applyAction, this, std::placeholders::_1));
   }
 }
 
 void LightServiceClass::update() {
   HTTP->handleClient();
+  pUdpControl.update();
+  pSchedules.update();
+  if (pSearchActive) {
+    updateSearch();
+  }
+  passRuleEvents();
+  pRules.update();
+  // push the state changes reported since the last call
+  if (pEventVersion != pStateVersion) {
+    pushLightEvents();
+  }
+  if (pSensorEventVersion != pSensorVersion) {
+    pushSensorEvent();
+  }
+  if (millis() - pEventKeepaliveMs > EVENT_KEEPALIVE_MS) {
+    // comment lines keep proxies from closing the connection and detect gone clients
+    static const char keepalive[] = ":\n\n";
+    broadcastEvent(keepalive, sizeof(keepalive) - 1);
+    pEventKeepaliveMs = millis();
+  }
+}
+
+// Server-Sent Events, see https://html.spec.whatwg.org/multipage/server-sent-events.html
+// Pushes the changes of the lights, groups and scenes, so the clients do not need to poll the API.
+void LightServiceClass::eventStreamFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
+{
+  int slot = -1;
+  for (int i = 0; i < MAX_EVENT_CLIENTS; i++) {
+    if (!pEventClients[i].connected()) {
+      pEventClients[i].stop();
+      slot = i;
+      break;
+    }
+  }
+  if (slot == -1) {
+    HTTP->send(503, "text/plain", "Too many event stream clients");
+    return;
+  }
+  // keep a copy of the connection, it stays open after the web server released it
+  pEventClients[slot] = HTTP->client();
+  pEventClients[slot].setNoDelay(true);
+  pEventClients[slot].print(F("HTTP/1.1 200 OK\r\n"
+                              "Content-Type: text/event-stream\r\n"
+                              "Cache-Control: no-cache\r\n"
+                              "Access-Control-Allow-Origin: *\r\n"
+                              "Connection: keep-alive\r\n\r\n"
+                              "retry: 2000\n\n"));
+  // the current state of all lights, the following events are deltas
+  char event[128];
+  for (int i = 0; i < getLightsAvailable(); i++) {
+    size_t length = formatLightEvent(event, sizeof(event), i);
+    writeEvent(pEventClients[slot], event, length);
+  }
+}
+
+// a slow client is dropped, the loop must not wait for the TCP window
+bool LightServiceClass::writeEvent(WiFiClient& client, const char *event, size_t length)
+{
+  if (!client.connected()) {
+    return false;
+  }
+  if (client.availableForWrite() < length) {
+    client.stop();
+    return false;
+  }
+  return client.write((const uint8_t*)event, length) == length;
+}
+
+void LightServiceClass::broadcastEvent(const char *event, size_t length)
+{
+  for (int i = 0; i < MAX_EVENT_CLIENTS; i++) {
+    writeEvent(pEventClients[i], event, length);
+  }
+}
+
+size_t LightServiceClass::formatLightEvent(char *buffer, size_t size, int numberOfTheLight)
+{
+  const LightInfo& info = pLightStates[numberOfTheLight];
+  int length = snprintf_P(buffer, size, PSTR("event: light\ndata: {\"id\":\"%d\",\"on\":%s,\"bri\":%u,\"hue\":%u,\"sat\":%u}\n\n"),
+                          numberOfTheLight + 1, info.on ? "true" : "false", info.brightness, info.hue, info.saturation);
+  return length < (int)size ? length : size - 1;
+}
+
+void LightServiceClass::pushLightEvents()
+{
+  LightMask changed = changedSince(pEventVersion);
+  pEventVersion = pStateVersion;
+  char event[128];
+  for (int i = changed.first(); i >= 0; i = changed.next(i)) {
+    size_t length = formatLightEvent(event, sizeof(event), i);
+    broadcastEvent(event, length);
+  }
+}
+
+// one rule event per changed source, the conditions only use on and bri of the lights
+void LightServiceClass::passRuleEvents()
+{
+  if (pRulesVersion != pStateVersion) {
+    LightMask changed = changedSince(pRulesVersion);
+    pRulesVersion = pStateVersion;
+    for (int i = changed.first(); i >= 0; i = changed.next(i)) {
+      uint8_t diff = pLightStates[i].diff(pRulesLightStates[i]);
+      pRulesLightStates[i] = pLightStates[i];
+      if (diff & (LIGHT_CHANGED_ON | LIGHT_CHANGED_BRI)) {
+        pRules.onEvent(RULE_SOURCE_LIGHT + i);
+      }
+    }
+  }
+  if (pRulesSensorVersion != pSensorVersion) {
+    pRulesSensorVersion = pSensorVersion;
+    if (pSensorState.presence != pRulesSensorState.presence || pSensorState.presenceUpdated != pRulesSensorState.presenceUpdated) {
+      pRules.onEvent(RULE_SOURCE_PRESENCE);
+    }
+    if (pSensorState.lightlevel != pRulesSensorState.lightlevel || pSensorState.dark != pRulesSensorState.dark
+        || pSensorState.lightlevelUpdated != pRulesSensorState.lightlevelUpdated) {
+      pRules.onEvent(RULE_SOURCE_LIGHTLEVEL);
+    }
+    pRulesSensorState = pSensorState;
+  }
+}
+
+void LightServiceClass::pushSensorEvent()
+{
+  pSensorEventVersion = pSensorVersion;
+  char buffer[128];
+  int length = snprintf_P(buffer, sizeof(buffer), PSTR("event: sensor\ndata: {\"presence\":%s,\"lightlevel\":%u,\"dark\":%s,\"suppressed\":%s}\n\n"),
+                          pSensorState.presence ? "true" : "false", pSensorState.lightlevel,
+                          pSensorState.dark ? "true" : "false", pSensorState.suppressed ? "true" : "false");
+  broadcastEvent(buffer, min(length, (int)sizeof(buffer) - 1));
+}
+
+// event is "group" or "scene", id as used in the API
+void LightServiceClass::pushChangeEvent(const char *event, int id, bool deleted)
+{
+  char buffer[96];
+  int length = snprintf_P(buffer, sizeof(buffer), PSTR("event: %s\ndata: {\"id\":\"%d\",\"deleted\":%s}\n\n"),
+                          event, id, deleted ? "true" : "false");
+  broadcastEvent(buffer, min(length, (int)sizeof(buffer) - 1));
 }
 
 void LightServiceClass::ntp_available(bool state)
 {
   ntpSet = state;
+  // the schedules run on the NTP time
+  pSchedules.clockChanged();
   time_t rawtime;
   struct tm * timeinfo;
   char buffer [80];
@@ -184,19 +473,17 @@ void LightServiceClass::ntp_available(bool state)
 }
 
 void LightServiceClass::on(WcFnHandlerFunction fn, const String &wcUri, HTTPMethod method, char wildcard) {
-    HTTP->addHandler(new WcFnRequestHandler(fn, wcUri, method, wildcard));
+    WcFnRequestHandler *handler = new WcFnRequestHandler(fn, wcUri, method, wildcard);
+    pRouteHandlers.push_back(handler);
+    HTTP->addHandler(handler);
 }
 
-String LightServiceClass::listFiles(String _template)
+String LightServiceClass::listFiles(PGM_P fileTemplate)
 {
-    DEBUG_PRINTLN(_template);
     String response = "";
-    for (int i = 0; i < 16; i++) {
-        String fileName = _template;
-        fileName.replace("%d",String(i));
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
+        String fileName = slotFileName(fileTemplate, i);
         DEBUG_PRINTLN(fileName);
-      
-        //sprintf(fileName,_template,i);
         if(!SPIFFS.exists(fileName))
             continue;
         DEBUG_PRINTLN("Adding file to list");
@@ -205,30 +492,17 @@ String LightServiceClass::listFiles(String _template)
     return response;
 }
 
-void LightServiceClass::clearFiles(String _template)
+void LightServiceClass::clearFiles(PGM_P fileTemplate)
 {
-    for (int i = 0; i < 16; i++) {
-        String fileName = _template;
-        fileName.replace("%d",String(i));
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
+        String fileName = slotFileName(fileTemplate, i);
         if(SPIFFS.exists(fileName)){
             SPIFFS.remove(fileName);   
         }
     }
 }
 
-void LightServiceClass::indexPageFn() {
-	String response = "<html><body>"
-	"<h2>Philips HUE ( {ip} )</h2>"
-	"<p>Available lights:</p>"
-	"<ul>{lights}</ul>"
-  "<ul>File Cache</ul>"
-  "<ul>Groups:</ul>"
-  "<ul>{group-files}</ul>"
-  "<ul>Scenes:</ul>"
-  "<ul>{scene-files}</ul>"
-  "<a href='/cache/clear'>Clear Cached Groups and Scenes</a>"
-	"</body></html>";
-	
+void LightServiceClass::indexPageFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method) {
 	String lights = "";
 	for (int i = 0; i < this->getLightsAvailable(); i++) {
 	    if (!pLightHandlers[i]) {
@@ -238,37 +512,109 @@ void LightServiceClass::indexPageFn() {
 	}
     String sceneFiles = listFiles(SCENE_FILE_TEMPLATE);
     String groupFiles = listFiles(GROUP_FILE_TEMPLATE);
-	  response.replace("{ip}", ipString);
-	  response.replace("{lights}", lights);
-	  response.replace("{group-files}", groupFiles);	
-    response.replace("{scene-files}", sceneFiles);  
-	  HTTP->send(200, "text/html", response);
+    size_t size = strlen_P(INDEX_PAGE_TEMPLATE) + strlen(pIdentity.ip) + lights.length() + groupFiles.length() + sceneFiles.length() + 1;
+    char *response = (char*)requestArena.allocate(size);
+    if (response == NULL) {
+        HTTP->send(500, "text/plain", "Out of memory");
+        return;
+    }
+    int length = snprintf_P(response, size, INDEX_PAGE_TEMPLATE, pIdentity.ip, lights.c_str(), groupFiles.c_str(), sceneFiles.c_str());
+    sendBuffer("text/html", response, length);
+    requestArena.deallocate(response);
 }
 
 // remove the group and scene cache files
-void LightServiceClass::cacheClearFn()
+void LightServiceClass::cacheClearFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
 {
     clearFiles(GROUP_FILE_TEMPLATE);
     clearFiles(SCENE_FILE_TEMPLATE);
-    indexPageFn();
+    indexPageFn(handler, requestUri, method);
 }
 
-void LightServiceClass::descriptionFn()
+void LightServiceClass::descriptionFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
 {
-  String response = SSDP_XML_TEMPLATE;
+  char escapedMac[13];
+  int pos = 0;
+  for (const char *c = pIdentity.mac; *c != '\0' && pos < 12; c++) {
+    if (*c != ':') {
+      escapedMac[pos++] = tolower(*c);
+    }
+  }
+  escapedMac[pos] = '\0';
+
+  // the port has at most 5 digits, the other arguments replace their format strings
+  size_t size = strlen_P(SSDP_XML_TEMPLATE) + 2 * strlen(pIdentity.ip) + 2 * strlen(escapedMac) + 6;
+  char *response = (char*)requestArena.allocate(size);
+  if (response == NULL) {
+    HTTP->send(500, "text/plain", "Out of memory");
+    return;
+  }
+  int length = snprintf_P(response, size, SSDP_XML_TEMPLATE, pIdentity.ip, WEB_PORT, pIdentity.ip, escapedMac, escapedMac);
+  sendBuffer("text/xml", response, length);
+  requestArena.deallocate(response);
+}
 
-  String escapedMac = macString;
-  escapedMac.replace(":", "");
-  escapedMac.toLowerCase();
-  
-  response.replace("{mac}", escapedMac);
-  response.replace("{ip}", ipString);
-  String port(WEB_PORT);
-  response.replace("{port}", port);
+// Prometheus text format, see https://prometheus.io/docs/instrumenting/exposition_formats/
+void LightServiceClass::metricsFn()
+{
+  String response;
+  response.reserve(4096);
+  metrics_print(response);
+  metrics_add_header(response, F("ansulta_request_arena_high_water_bytes"), F("gauge"), F("Most memory used by a single request in the request arena."));
+  metrics_add_value(response, F("ansulta_request_arena_high_water_bytes"), NULL, requestArena.highWater());
+  metrics_add_header(response, F("ansulta_request_arena_capacity_bytes"), F("gauge"), F("Size of the request arena."));
+  metrics_add_value(response, F("ansulta_request_arena_capacity_bytes"), NULL, requestArena.capacity());
+  metrics_add_header(response, F("ansulta_request_arena_fallbacks_total"), F("counter"), F("Allocations served by malloc because the request arena was exhausted."));
+  metrics_add_value(response, F("ansulta_request_arena_fallbacks_total"), NULL, requestArena.fallbackCount());
+  int eventClients = 0;
+  for (int i = 0; i < MAX_EVENT_CLIENTS; i++) {
+    if (pEventClients[i].connected()) {
+      eventClients++;
+    }
+  }
+  metrics_add_header(response, F("ansulta_event_stream_clients"), F("gauge"), F("Clients connected to /eventstream."));
+  metrics_add_value(response, F("ansulta_event_stream_clients"), NULL, eventClients);
+  metrics_add_header(response, F("ansulta_http_requests_total"), F("counter"), F("HTTP requests handled per API route."));
+  for (unsigned int i = 0; i < pRouteHandlers.size(); i++) {
+    String label = "route=\"" + pRouteHandlers[i]->getUri() + "\"";
+    metrics_add_value(response, F("ansulta_http_requests_total"), label.c_str(), pRouteHandlers[i]->getRequestCount());
+  }
+  metrics_add_header(response, F("ansulta_http_request_duration_microseconds"), F("summary"), F("Time spent in the API route handlers."));
+  for (unsigned int i = 0; i < pRouteHandlers.size(); i++) {
+    String label = "route=\"" + pRouteHandlers[i]->getUri() + "\"";
+    metrics_add_value(response, F("ansulta_http_request_duration_microseconds_sum"), label.c_str(), pRouteHandlers[i]->getLatencySum());
+    metrics_add_value(response, F("ansulta_http_request_duration_microseconds_count"), label.c_str(), pRouteHandlers[i]->getRequestCount());
+  }
+  metrics_add_header(response, F("ansulta_http_request_duration_max_microseconds"), F("gauge"), F("Slowest request per API route."));
+  for (unsigned int i = 0; i < pRouteHandlers.size(); i++) {
+    String label = "route=\"" + pRouteHandlers[i]->getUri() + "\"";
+    metrics_add_value(response, F("ansulta_http_request_duration_max_microseconds"), label.c_str(), pRouteHandlers[i]->getLatencyMax());
+  }
+  capture_print_metrics(response);
+  HTTP->send(200, "text/plain; version=0.0.4", response);
+}
 
-  HTTP->send(200, "text/xml", response);
-  DEBUG_PRINTLN(response);
+// received radio frames with status bytes in pcap format, decode with tools/capture_decode.py
+void LightServiceClass::captureFn()
+{
+  uint16_t count = capture_pending();
+  HTTP->setContentLength(capture_dump_size(count));
+  HTTP->send(200, "application/vnd.tcpdump.pcap", "");
+  WiFiClient client = HTTP->client();
+  capture_dump(client, count);
+}
+
+#ifdef TRACE
+// binary dump of the trace ring, decode with tools/trace_decode.py
+void LightServiceClass::traceFn()
+{
+  uint16_t count = trace_pending();
+  HTTP->setContentLength(trace_dump_size(count));
+  HTTP->send(200, "application/octet-stream", "");
+  WiFiClient client = HTTP->client();
+  trace_dump(client, count);
 }
+#endif
 
 void LightServiceClass::unimpFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
 {
@@ -278,10 +624,10 @@ void LightServiceClass::unimpFn(WcFnRequestHandler *handler, String requestUri,
 }
 
 // targetBase is assumed to have a trailing slash (/)
-String LightServiceClass::generateTargetPutResponse(JsonObject &body, String targetBase)
+void LightServiceClass::sendTargetPutResponse(JsonObject &body, String targetBase)
 {
     // example: [{"success":{"/lights/1/state/hue":254}}]
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonArray& root = jsonBuffer.createArray();
     for (JsonObject::iterator it=body.begin(); it!=body.end(); ++it) {
         String target = targetBase + it->key;
@@ -289,23 +635,21 @@ String LightServiceClass::generateTargetPutResponse(JsonObject &body, String tar
         JsonObject& success = root_x.createNestedObject("success");
         success[target] = it->value;
     }
-    String msg;
-    root.printTo(msg);
-    return msg;
+    sendJson(root);
 }
 
 void LightServiceClass::addConfigJson(JsonObject& root)
 {
     root["name"] = "hue emulator";
     root["swversion"] = "81012917";
-    root["bridgeid"]  = bridgeIDString;
+    root["bridgeid"]  = pIdentity.bridgeID;
     root["portalservices"] = false;
     root["linkbutton"] = true;
-    root["mac"] = macString;
+    root["mac"] = pIdentity.mac;
     root["dhcp"] = true;
-    root["ipaddress"] = ipString;
-    root["netmask"] = netmaskString;
-    root["gateway"] = gatewayString;
+    root["ipaddress"] = pIdentity.ip;
+    root["netmask"] = pIdentity.netmask;
+    root["gateway"] = pIdentity.gateway;
     root["apiversion"] = "1.3.0";
     if (ntpSet) {
 //      string (19..19) ISO8601:2004
@@ -335,36 +679,46 @@ void LightServiceClass::addConfigJson(JsonObject& root)
 void LightServiceClass::sendJson(JsonObject& root)
 {
     // Take JsonObject and print it to Serial and to WiFi
-    String msg;
-    root.printTo(msg);
-    DEBUG_PRINT(millis());
-    DEBUG_PRINT(": ");
-    DEBUG_PRINTLN(msg);
-    HTTP->send(200, "application/json", msg);
+    size_t length = root.measureLength();
+    char *msg = (char*)requestArena.allocate(length + 1);
+    if (msg == NULL) {
+        HTTP->send(500, "text/plain", "Out of memory");
+        return;
+    }
+    root.printTo(msg, length + 1);
+    sendBuffer("application/json", msg, length);
+    // frees the malloc fallback, arena memory is released after the request
+    requestArena.deallocate(msg);
 }
 
 void LightServiceClass::sendJson(JsonArray& root)
 {
-    // Take JsonObject and print it to Serial and to WiFi
-    String msg;
-    root.printTo(msg);
-    DEBUG_PRINT(millis());
-    DEBUG_PRINT(": ");
-    DEBUG_PRINTLN(msg);
-    HTTP->send(200, "application/json", msg);
+    // Take JsonArray and print it to Serial and to WiFi
+    size_t length = root.measureLength();
+    char *msg = (char*)requestArena.allocate(length + 1);
+    if (msg == NULL) {
+        HTTP->send(500, "text/plain", "Out of memory");
+        return;
+    }
+    root.printTo(msg, length + 1);
+    sendBuffer("application/json", msg, length);
+    // frees the malloc fallback, arena memory is released after the request
+    requestArena.deallocate(msg);
 }
 
-void LightServiceClass::sendJson(String msg)
+// sends the buffer without copying it into a String
+void LightServiceClass::sendBuffer(const char *contentType, const char *msg, size_t length)
 {
-    // Take string and print it to Serial and to WiFi
     DEBUG_PRINT(millis());
     DEBUG_PRINT(": ");
     DEBUG_PRINTLN(msg);
-    HTTP->send(200, "application/json", msg);
+    HTTP->setContentLength(length);
+    HTTP->send(200, contentType, "");
+    HTTP->client().write((const uint8_t*)msg, length);
 }
 
 void LightServiceClass::sendError(int type, String path, String description) {
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonObject& root = jsonBuffer.createObject();
     JsonObject& errorObject = root.createNestedObject("error");
     errorObject["type"] = type;
@@ -374,7 +728,7 @@ void LightServiceClass::sendError(int type, String path, String description) {
 }
 
 void LightServiceClass::sendSuccess(String id, String value) {
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonArray& root = jsonBuffer.createArray();
     JsonObject& root_0 = root.createNestedObject();
     JsonObject& root_0_success = root_0.createNestedObject("success");
@@ -383,7 +737,7 @@ void LightServiceClass::sendSuccess(String id, String value) {
 }
 
 void LightServiceClass::sendSuccess(String value) {
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonArray& root = jsonBuffer.createArray();
     JsonObject& success = root.createNestedObject();
     success["success"] = value;
@@ -399,7 +753,7 @@ void LightServiceClass::configFn(WcFnRequestHandler *handler, String requestUri,
 {
     switch (method) {
         case HTTP_GET: {
-            DynamicJsonBuffer jsonBuffer;
+            RequestJsonBuffer jsonBuffer;
             JsonObject& root = jsonBuffer.createObject();
             addConfigJson(root);
             sendJson(root);
@@ -408,11 +762,11 @@ void LightServiceClass::configFn(WcFnRequestHandler *handler, String requestUri,
         case HTTP_PUT: {
             DEBUG_PRINT("configFn:");
             DEBUG_PRINTLN(HTTP->arg("plain"));
-            DynamicJsonBuffer jsonBuffer;
+            RequestJsonBuffer jsonBuffer;
             // Parse JSON object
             JsonObject& body = jsonBuffer.parseObject(HTTP->arg("plain"));
             if (body.success()) {
-                sendJson(generateTargetPutResponse(body, "/config/"));
+                sendTargetPutResponse(body, "/config/");
                 //aJson.deleteItem(body);
                 // TODO: actually store this
             }
@@ -435,7 +789,7 @@ void LightServiceClass::authFn(WcFnRequestHandler *handler, String requestUri, H
 bool LightServiceClass::getGroupJson(JsonObject& root)
 {
     // iterate over groups and serialize
-    for (int i = 0; i < 16; i++) {
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
         if (pLightGroups[i]) {
             String sIndex = "";
             sIndex += (i + 1);
@@ -449,12 +803,12 @@ bool LightServiceClass::getGroupJson(JsonObject& root)
 bool LightServiceClass::getSceneJson(JsonObject& root)
 {
     // iterate over scenes and serialize
-    for (int i = 0; i < 16; i++) {
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
         if (pLightScenes[i]) {
             DEBUG_PRINT("Returning Scene :");
-            DEBUG_PRINTLN(pLightScenes[i]->id.c_str());
-            JsonObject& lightScene = root.createNestedObject(pLightScenes[i]->id);
-            pLightScenes[i]->fillSceneJson(lightScene, true, this);
+            DEBUG_PRINTLN(pLightScenes[i]->getId());
+            JsonObject& lightScene = root.createNestedObject(pLightScenes[i]->getId());
+            pLightScenes[i]->fillSceneJson(lightScene, sceneStates(i));
         }
     }
     return root.success();
@@ -478,8 +832,8 @@ void LightServiceClass::addLightJson(JsonObject& root, int numberOfTheLight, Lig
     String lightName = lightHandler->getFriendlyName(numberOfTheLight);
     JsonObject& light = root.createNestedObject(lightNumber);
 
-    LightInfo info = lightHandler->getInfo(numberOfTheLight);
-    if (info.bulbType == BulbType::DIMMABLE_LIGHT) {
+    const LightInfo& info = pLightStates[numberOfTheLight];
+    if (info.getBulbType() == BulbType::DIMMABLE_LIGHT) {
         light["type"] = "Dimmable light";
     } else {
         light["type"] = "Extended color light";
@@ -488,7 +842,7 @@ void LightServiceClass::addLightJson(JsonObject& root, int numberOfTheLight, Lig
     light["manufacturername"] = "OpenSource";  // type of lamp (all "Extended colour light" for now)
     light["swversion"] = "0.1";
     light["name"] = lightName;  // the name as set through the web UI or app
-    light["uniqueid"] = macString + "-" + (String) (numberOfTheLight + 1);
+    light["uniqueid"] = String(pIdentity.mac) + "-" + (String) (numberOfTheLight + 1);
     light["modelid"] = "LST001";  // the model number
 
     JsonObject& state = light.createNestedObject("state");
@@ -496,12 +850,12 @@ void LightServiceClass::addLightJson(JsonObject& root, int numberOfTheLight, Lig
     DEBUG_PRINTLN("addLightJson");
     state["bri"] = info.brightness;  // brightness between 0-254 (NB 0 is not off!)
 
-    if (info.bulbType == BulbType::EXTENDED_COLOR_LIGHT) {
+    if (info.getBulbType() == BulbType::EXTENDED_COLOR_LIGHT) {
         JsonArray& xy = state.createNestedArray("xy");  // xy mode: CIE 1931 color co-ordinates
         xy.add(0.0);
         xy.add(0.0);
         state["colormode"] = "hs";  // the current color mode
-        state["effect"] = info.effect == EFFECT_COLORLOOP ? "colorloop" : "none";
+        state["effect"] = info.getEffect() == EFFECT_COLORLOOP ? "colorloop" : "none";
         state["ct"] = 500;  // ct mode: color temp (expressed in mireds range 154-500)
         state["hue"] = info.hue;  // hs mode: the hue (expressed in ~deg*182.04)
         state["sat"] = info.saturation;  // hs mode: saturation between 0-254
@@ -514,7 +868,7 @@ void LightServiceClass::addLightJson(JsonObject& root, int numberOfTheLight, Lig
 void LightServiceClass::wholeConfigFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
 {
     // DEBUG_PRINTLN("Respond with complete json as in https://github.com/probonopd/ESP8266HueEmulator/wiki/Hue-API#get-all-information-about-the-bridge");
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonObject& root = jsonBuffer.createObject();
     JsonObject& lights = root.createNestedObject("lights");
     addLightsJson(lights);
@@ -522,18 +876,17 @@ void LightServiceClass::wholeConfigFn(WcFnRequestHandler *handler, String reques
     getGroupJson(groups);
     JsonObject& config = root.createNestedObject("config");
     addConfigJson(config);
-    JsonObject& schedules = root.createNestedObject("schedules");
-    JsonObject& scenes = root.createNestedObject("scenes");
-    getSceneJson(scenes);
-    JsonObject& rules = root.createNestedObject("rules");
-    JsonObject& sensors = root.createNestedObject("sensors");
-    JsonObject& resourcelinks = root.createNestedObject("resourcelinks");
+    pSchedules.fillAllJson(root.createNestedObject("schedules"));
+    getSceneJson(root.createNestedObject("scenes"));
+    pRules.fillAllJson(root.createNestedObject("rules"));
+    addSensorsJson(root.createNestedObject("sensors"));
+    root.createNestedObject("resourcelinks");
     sendJson(root);
 }
 
 void LightServiceClass::sceneListingHandler()
 {
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonObject& root = jsonBuffer.createObject();
     getSceneJson(root);
     sendJson(root);
@@ -542,10 +895,10 @@ void LightServiceClass::sceneListingHandler()
 int LightServiceClass::findSceneIndex(String id)
 {
     int index = -1;
-    for (int i = 0; i < 16; i++) {
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
         LightGroup *scene = pLightScenes[i];
         if (scene) {
-            if (scene->id == id) {
+            if (id == scene->getId()) {
                 return i;
             }
         } else if (index == -1) {
@@ -564,7 +917,7 @@ bool LightServiceClass::updateSceneSlot(int slot, String id, String body)
     if (body == "") {
         return false;
     }
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonObject& root = jsonBuffer.parseObject(body);
     if (!root.success() || !validateGroupCreateBody(root)) {
         // throw error bad body
@@ -573,19 +926,93 @@ bool LightServiceClass::updateSceneSlot(int slot, String id, String body)
     } 
     DEBUG_PRINT("updateSceneSlot:");
     DEBUG_PRINTLN(body);
+    clearSceneSlot(slot);
+    pLightScenes[slot] = pGroupPool.allocate(root);
+    if (!pLightScenes[slot]) {
+        sendError(301, "scenes", "Scenes table full");
+        return false;
+    }
+    if (!loadSceneStates(slot, root)) {
+        pGroupPool.release(pLightScenes[slot]);
+        pLightScenes[slot] = nullptr;
+        sendError(301, "scenes", "Scene light states full");
+        return false;
+    }
+    pushChangeEvent("scene", slot, false);
+    return true;
+}
+
+void LightServiceClass::clearSceneSlot(int slot)
+{
     if (pLightScenes[slot]) {
-        String fileName = SCENE_FILE_TEMPLATE;
-        fileName.replace("%d", String(slot));
-        delete pLightScenes[slot];
+        String fileName = slotFileName(SCENE_FILE_TEMPLATE, slot);
+        releaseSceneStates(slot);
+        pGroupPool.release(pLightScenes[slot]);
         pLightScenes[slot] = nullptr;
         if (SPIFFS.exists(fileName)){
             SPIFFS.remove(fileName);   
         }
     }
-    pLightScenes[slot] = new LightGroup(root);
+}
+
+// the current states of the scene lights, replaced by the "lightstates" given in root,
+// returns false if the scene state store has no room for the members
+bool LightServiceClass::loadSceneStates(int slot, JsonObject& root)
+{
+    const LightMask& lights = pLightScenes[slot]->getLightMask();
+    int count = lights.count();
+    if (pSceneStatesUsed + count > MAX_SCENE_LIGHT_STATES) {
+        return false;
+    }
+    pLightScenes[slot]->setStatesStart(pSceneStatesUsed);
+    pSceneStatesUsed += count;
+    JsonObject& lightstates = root["lightstates"];
+    LightInfo* states = sceneStates(slot);
+    for (int i = lights.first(); i >= 0; i = lights.next(i)) {
+        LightInfo& state = *states++;
+        state = pLightStates[i];
+        if (lightstates.success()) {
+            JsonObject& lightState = lightstates[String(i + 1)];
+            LightInfo newInfo;
+            if (lightState.success() && parseHueLightInfo(state, lightState, &newInfo)) {
+                state = newInfo;
+            }
+        }
+    }
     return true;
 }
 
+// closes the gap of the states in the store, scenes are rarely deleted
+void LightServiceClass::releaseSceneStates(int slot)
+{
+    int start = pLightScenes[slot]->getStatesStart();
+    if (start < 0) {
+        return;
+    }
+    int count = pLightScenes[slot]->getLightMask().count();
+    memmove(&pSceneStates[start], &pSceneStates[start + count], (pSceneStatesUsed - start - count) * sizeof(LightInfo));
+    pSceneStatesUsed -= count;
+    pLightScenes[slot]->setStatesStart(-1);
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
+        if (pLightScenes[i] && pLightScenes[i]->getStatesStart() > start) {
+            pLightScenes[i]->setStatesStart(pLightScenes[i]->getStatesStart() - count);
+        }
+    }
+}
+
+// target states of the scene in the order of its light numbers, nullptr without states
+LightInfo* LightServiceClass::sceneStates(int slot)
+{
+    int start = pLightScenes[slot]->getStatesStart();
+    return start < 0 ? nullptr : &pSceneStates[start];
+}
+
+// light must be a member of the scene
+LightInfo& LightServiceClass::sceneState(int slot, int light)
+{
+    return sceneStates(slot)[pLightScenes[slot]->getLightMask().rank(light)];
+}
+
 void saveToFile(String fileName, JsonObject &root)
 {
     File file = SPIFFS.open(fileName, "w");
@@ -619,20 +1046,47 @@ void LightServiceClass::sceneCreationHandler(String id)
         // TODO - add file saves here
         DEBUG_PRINT("updating lightScene->id to ");
         DEBUG_PRINTLN(id);
-        pLightScenes[sceneIndex]->id = id;
+        pLightScenes[sceneIndex]->setId(id.c_str());
         sendSuccess("id", id);
-        // now save to file
-        String fileName = SCENE_FILE_TEMPLATE;
-        fileName.replace("%d", String(sceneIndex));
-        DEBUG_PRINT("Updating Scene ");
-        DEBUG_PRINT(id);
-        DEBUG_PRINTLN(fileName);
-        DynamicJsonBuffer jsonBuffer;
-        // Parse the root object
-        JsonObject &root = jsonBuffer.createObject();
-        pLightScenes[sceneIndex]->fillSceneJson(root, true, this);
-        saveToFile(fileName, root);
+        saveSceneSlot(sceneIndex);
+    }
+}
+
+void LightServiceClass::saveSceneSlot(int slot)
+{
+    String fileName = slotFileName(SCENE_FILE_TEMPLATE, slot);
+    DEBUG_PRINT("Updating Scene ");
+    DEBUG_PRINTLN(fileName);
+    RequestJsonBuffer jsonBuffer;
+    JsonObject &root = jsonBuffer.createObject();
+    pLightScenes[slot]->fillSceneJson(root, sceneStates(slot));
+    saveToFile(fileName, root);
+}
+
+// applies the stored states of the scene lights in lights, the lights already in the target state are skipped
+bool LightServiceClass::recallScene(String id, const LightMask& lights)
+{
+    int slot = findSceneIndex(id);
+    if (slot < 0 || !pLightScenes[slot] || id != pLightScenes[slot]->getId()) {
+        return false;
+    }
+    // compute the delta first, the handlers report back into pLightStates while dispatching
+    LightMask changed;
+    const LightMask& sceneLights = pLightScenes[slot]->getLightMask();
+    const LightInfo* states = sceneStates(slot);
+    for (int i = sceneLights.first(); i >= 0 && i < getLightsAvailable(); i = sceneLights.next(i), states++) {
+        if (lights.test(i) && (states->diff(pLightStates[i]) & (LIGHT_CHANGED_ON | LIGHT_CHANGED_BRI | LIGHT_CHANGED_COLOR))) {
+            changed.set(i);
+        }
     }
+    DEBUG_PRINT("recall scene ");
+    DEBUG_PRINT(id);
+    DEBUG_PRINT(", lights to change: ");
+    DEBUG_PRINTLN(changed.count());
+    for (int i = changed.first(); i >= 0; i = changed.next(i)) {
+        applyLightState(i, sceneState(slot, i), JsonObject::invalid());
+    }
+    return true;
 }
 
 String LightServiceClass::scenePutHandler(String id)
@@ -653,9 +1107,9 @@ String LightServiceClass::scenePutHandler(String id)
         // TODO - add file saves here
         DEBUG_PRINT("updating lightScene->id to ");
         DEBUG_PRINTLN(id);
-        pLightScenes[sceneIndex]->id = id;
+        pLightScenes[sceneIndex]->setId(id.c_str());
 
-        DynamicJsonBuffer jsonBuffer;
+        RequestJsonBuffer jsonBuffer;
         JsonArray& root = jsonBuffer.createArray();
         JsonObject& success1 = root.createNestedObject();
         JsonObject& success2 = root.createNestedObject();
@@ -668,27 +1122,15 @@ String LightServiceClass::scenePutHandler(String id)
         sprintf(addressBuffer,"/scenes/%d/lights",sceneIndex);
         addr2["address"] = addressBuffer;
         JsonArray& lights = addr2.createNestedArray("value");
-        for (int i = 0; i < 16; i++) {
-            if (!((1 << i) & pLightScenes[sceneIndex]->getLightMask())) {
-                continue;
-            }
+        const LightMask& sceneLights = pLightScenes[sceneIndex]->getLightMask();
+        for (int i = sceneLights.first(); i >= 0; i = sceneLights.next(i)) {
             // add light to list
             String lightNum = "";
             lightNum += (i + 1);
             lights.add(lightNum.c_str());
         }
         sendJson(root);
-        // now save to file
-        // reuse buffer
-        jsonBuffer.clear();
-        JsonObject& save_root = jsonBuffer.createObject();
-        String fileName = SCENE_FILE_TEMPLATE;
-        fileName.replace("%d", String(sceneIndex));
-        DEBUG_PRINT("Updating Scene ");
-        DEBUG_PRINT(id);
-        DEBUG_PRINTLN(fileName);
-        pLightScenes[sceneIndex]->fillSceneJson(save_root, true, this);
-        saveToFile(fileName, save_root);
+        saveSceneSlot(sceneIndex);
     }
     return id;
 }
@@ -714,10 +1156,10 @@ void LightServiceClass::scenesFn(WcFnRequestHandler *handler, String requestUri,
 
 LightGroup *LightServiceClass::findScene(String id)
 {
-    for (int i = 0; i < 16; i++) {
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
         LightGroup *scene = pLightScenes[i];
         if (scene) {
-            if (scene->id == id) {
+            if (id == scene->getId()) {
                 return scene;
             }
         }
@@ -732,23 +1174,43 @@ void LightServiceClass::scenesIdFn(WcFnRequestHandler *handler, String requestUr
     switch (method) {
         case HTTP_GET:
             if (scene) {
-                DynamicJsonBuffer jsonBuffer;
+                RequestJsonBuffer jsonBuffer;
                 JsonObject& root = jsonBuffer.createObject();
-                scene->fillSceneJson(root, true, this);
+                scene->fillSceneJson(root, sceneStates(findSceneIndex(sceneId)));
                 sendJson(root);
             } else {
                 sendError(3, "/scenes/"+sceneId, "Cannot retrieve scene that does not exist");
             }
             break;
-        case HTTP_PUT:
+        case HTTP_PUT: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& root = jsonBuffer.parseObject(HTTP->arg("plain"));
+            if (scene && root.success() && !root.containsKey("lights")) {
+                // {"storelightstate": true} captures the current states of the scene lights
+                if (root["storelightstate"].as<bool>()) {
+                    int sceneIndex = findSceneIndex(sceneId);
+                    const LightMask& lights = scene->getLightMask();
+                    LightInfo* states = sceneStates(sceneIndex);
+                    for (int i = lights.first(); i >= 0; i = lights.next(i)) {
+                        *states++ = pLightStates[i];
+                    }
+                    saveSceneSlot(sceneIndex);
+                    pushChangeEvent("scene", sceneIndex, false);
+                }
+                sendTargetPutResponse(root, "/scenes/" + sceneId + "/");
+                break;
+            }
             // validate body, delete old group, create new group
             sceneCreationHandler(sceneId);
             // XXX not a valid response according to API
             sendUpdated();
             break;
+        }
         case HTTP_DELETE:
             if (scene) {
-                updateSceneSlot(findSceneIndex(sceneId), sceneId, "");
+                int sceneIndex = findSceneIndex(sceneId);
+                clearSceneSlot(sceneIndex);
+                pushChangeEvent("scene", sceneIndex, true);
             } else {
                 sendError(3, requestUri, "Cannot delete scene that does not exist");
             }
@@ -764,14 +1226,30 @@ void LightServiceClass::scenesIdLightFn(WcFnRequestHandler *handler, String requ
 {
     switch (method) {
         case HTTP_PUT: {
+            String sceneId = handler->getWildCard(1);
+            int lightNum = atoi(handler->getWildCard(2).c_str()) - 1;
+            int sceneIndex = findSceneIndex(sceneId);
+            if (sceneIndex < 0 || !pLightScenes[sceneIndex] || sceneId != pLightScenes[sceneIndex]->getId()
+                || !pLightScenes[sceneIndex]->getLightMask().test(lightNum)) {
+                sendError(3, requestUri, "Scene or light not available");
+                break;
+            }
             String body = HTTP->arg("plain");
             DEBUG_PRINT("Body: ");
             DEBUG_PRINTLN(body);
-            // XXX Do something with this information...
-            DynamicJsonBuffer jsonBuffer;
+            RequestJsonBuffer jsonBuffer;
             JsonObject& root = jsonBuffer.parseObject(body);
-            if (root.success()) {
-                sendJson(generateTargetPutResponse(root, "/scenes/" + handler->getWildCard(1) + "/lightstates/" + handler->getWildCard(2) + "/"));
+            if (!root.success()) {
+                sendError(2, requestUri, "Bad JSON body in request");
+                break;
+            }
+            LightInfo newInfo;
+            // parseHueLightInfo sends the errors
+            if (parseHueLightInfo(sceneState(sceneIndex, lightNum), root, &newInfo)) {
+                sceneState(sceneIndex, lightNum) = newInfo;
+                sendTargetPutResponse(root, "/scenes/" + sceneId + "/lightstates/" + handler->getWildCard(2) + "/");
+                saveSceneSlot(sceneIndex);
+                pushChangeEvent("scene", sceneIndex, false);
             }
             break;
         }
@@ -783,7 +1261,7 @@ void LightServiceClass::scenesIdLightFn(WcFnRequestHandler *handler, String requ
 
 void LightServiceClass::groupListingHandler()
 {
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonObject& root = jsonBuffer.createObject();
     getGroupJson(root);
     sendJson(root);
@@ -792,10 +1270,11 @@ void LightServiceClass::groupListingHandler()
 // returns true on failure
 bool LightServiceClass::updateGroupSlot(int slot, String body)
 {
-    if (body == "") {
+    // group 0 contains all lights and can not be changed
+    if (body == "" || slot < 0) {
         return false;
     }
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonObject& root = jsonBuffer.parseObject(body);
     if (!root.success() || !validateGroupCreateBody(root)) {
         // throw error bad body
@@ -804,33 +1283,60 @@ bool LightServiceClass::updateGroupSlot(int slot, String body)
     } 
     DEBUG_PRINT("updateGroupSlot:");
     DEBUG_PRINTLN(body);
-    String fileName = GROUP_FILE_TEMPLATE;
-    fileName.replace("%d", String(slot));
-    if (pLightScenes[slot]) {
-        delete pLightScenes[slot];
-        pLightScenes[slot] = nullptr;
-        if (SPIFFS.exists(fileName)){
-            SPIFFS.remove(fileName);   
-        }
-    }
+    String fileName = slotFileName(GROUP_FILE_TEMPLATE, slot);
+    clearGroupSlot(slot);
     DEBUG_PRINT("Updating ");
     DEBUG_PRINTLN(fileName);
-    pLightScenes[slot] = new LightGroup(root);
+    pLightGroups[slot] = pGroupPool.allocate(root);
+    if (!pLightGroups[slot]) {
+        sendError(301, "groups", "Groups table full");
+        return false;
+    }
+    indexGroupSlot(slot, true);
 
     jsonBuffer.clear();
-    //DynamicJsonBuffer jsonBuffer2(capacity);
     JsonObject& save_root = jsonBuffer.createObject();
-    pLightScenes[slot]->fillJson(save_root);
+    pLightGroups[slot]->fillJson(save_root);
     saveToFile(fileName, save_root);
+    pushChangeEvent("group", slot + 1, false);
     return true;
 }
 
+void LightServiceClass::clearGroupSlot(int slot)
+{
+    if (slot >= 0 && pLightGroups[slot]) {
+        String fileName = slotFileName(GROUP_FILE_TEMPLATE, slot);
+        indexGroupSlot(slot, false);
+        pGroupPool.release(pLightGroups[slot]);
+        pLightGroups[slot] = nullptr;
+        if (SPIFFS.exists(fileName)){
+            SPIFFS.remove(fileName);   
+        }
+    }
+}
+
+// adds or removes the group in the memberships of its lights
+void LightServiceClass::indexGroupSlot(int slot, bool add)
+{
+    const LightMask& lights = pLightGroups[slot]->getLightMask();
+    for (int i = lights.first(); i >= 0; i = lights.next(i)) {
+        if (add) {
+            pLightMemberships[i].set(slot);
+        } else {
+            pLightMemberships[i].clear(slot);
+        }
+    }
+    if (add) {
+        pLightGroups[slot]->initState(pLightStates);
+    }
+}
+
 void LightServiceClass::groupCreationHandler()
 {
     // handle group creation
     // find first available group slot
     int availableSlot = -1;
-    for (int i = 0; i < 16; i++) {  // TEST start at 1 instead of 0
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {  // TEST start at 1 instead of 0
         if (!pLightGroups[i]) {   
             availableSlot = i;
             break;
@@ -867,7 +1373,7 @@ void LightServiceClass::groupsIdFn(WcFnRequestHandler *handler, String requestUr
 {
     String groupNumText = handler->getWildCard(1);
     int groupNum = atoi(groupNumText.c_str()) - 1;
-    if ((groupNum == -1 && groupNumText != "0") || groupNum >= 16 || (groupNum >= 0 && !pLightGroups[groupNum])) {
+    if ((groupNum == -1 && groupNumText != "0") || groupNum >= MAX_LIGHT_GROUPS || (groupNum >= 0 && !pLightGroups[groupNum])) {
         // error, invalid group number
         sendError(3, requestUri, "Invalid group number");
         return;
@@ -875,10 +1381,10 @@ void LightServiceClass::groupsIdFn(WcFnRequestHandler *handler, String requestUr
 
     switch (method) {
         case HTTP_GET: {
-            DynamicJsonBuffer jsonBuffer;
+            RequestJsonBuffer jsonBuffer;
             JsonObject& root = jsonBuffer.createObject();
             if (groupNum != -1) {
-                pLightScenes[groupNum]->fillJson(root);
+                pLightGroups[groupNum]->fillJson(root);
                 sendJson(root);
             } else {
                 root["name"] = "0";
@@ -892,6 +1398,7 @@ void LightServiceClass::groupsIdFn(WcFnRequestHandler *handler, String requestUr
                     lightNum += (i + 1);
                     lightsArray.add(lightNum);
                 }
+                LightGroup::fillStateJson(root, pAllCount, pAllOnCount, pAllBriSum);
                 sendJson(root);
             }
             break;
@@ -903,7 +1410,13 @@ void LightServiceClass::groupsIdFn(WcFnRequestHandler *handler, String requestUr
             break;
         }
         case HTTP_DELETE: {
-            updateGroupSlot(groupNum, "");
+            if (groupNum == -1) {
+                // group 0 contains all lights and can not be deleted
+                sendError(305, requestUri, "Group 0 can not be deleted");
+                break;
+            }
+            clearGroupSlot(groupNum);
+            pushChangeEvent("group", groupNum + 1, true);
             sendSuccess(requestUri+" deleted");
             break;
         }
@@ -914,7 +1427,7 @@ void LightServiceClass::groupsIdFn(WcFnRequestHandler *handler, String requestUr
     }
 }
 
-bool LightServiceClass::parseHueLightInfo(LightInfo currentInfo, JsonObject& root, LightInfo *newInfo)
+bool LightServiceClass::parseHueLightInfo(const LightInfo& currentInfo, JsonObject& root, LightInfo *newInfo)
 {
     *newInfo = currentInfo;
     if (root.containsKey("on")) {
@@ -922,31 +1435,31 @@ bool LightServiceClass::parseHueLightInfo(LightInfo currentInfo, JsonObject& roo
     }
     // pull brightness
     if (root.containsKey("bri")) {
-        newInfo->brightness = root["bri"];
+        newInfo->brightness = constrain(root["bri"].as<int>(), 0, 254);
     }
     // pull effect
     if (root.containsKey("effect")) {
         String effect = root["effect"];
         if (strcmp(effect.c_str(), "colorloop") == 0) {
-            newInfo->effect = EFFECT_COLORLOOP;
+            newInfo->setEffect(EFFECT_COLORLOOP);
         } else {
-            newInfo->effect = EFFECT_NONE;
+            newInfo->setEffect(EFFECT_NONE);
         }
     }
     // pull alert
     if (root.containsKey("alert")) {
         String alert = root["alert"];
         if (strcmp(alert.c_str(), "select") == 0) {
-            newInfo->alert = ALERT_SELECT;
+            newInfo->setAlert(ALERT_SELECT);
         } else if (strcmp(alert.c_str(), "lselect") == 0) {
-            newInfo->alert = ALERT_LSELECT;
+            newInfo->setAlert(ALERT_LSELECT);
         } else {
-            newInfo->alert = ALERT_NONE;
+            newInfo->setAlert(ALERT_NONE);
         }
     }
     // pull transitiontime
     if (root.containsKey("transitiontime")) {
-        newInfo->transitionTime = root["transitiontime"];
+        newInfo->transitionTime = constrain(root["transitiontime"].as<long>(), 0L, 65535L);
     }
     if (root.containsKey("xy")) {
         JsonArray& xyState = root["xy"];
@@ -961,7 +1474,7 @@ bool LightServiceClass::parseHueLightInfo(LightInfo currentInfo, JsonObject& roo
         newInfo->saturation = getSaturation(hsb);
     } else if (root.containsKey("ct")) {
         int mirek = root["ct"];
-        if (mirek > 500 || mirek < 153) {
+        if (mirek > MIREK_MAX || mirek < MIREK_MIN) {
             sendError(7, "/api/api/lights/?/state", "Invalid value for color temperature");
             return false;
         }
@@ -970,29 +1483,35 @@ bool LightServiceClass::parseHueLightInfo(LightInfo currentInfo, JsonObject& roo
         newInfo->saturation = getSaturation(hsb);
     } else {
         if (root.containsKey("hue")) {
-            newInfo->hue = root["hue"];
+            newInfo->hue = constrain(root["hue"].as<long>(), 0L, 65535L);
         }
         if (root.containsKey("sat")) {
-            newInfo->saturation = root["sat"];
+            newInfo->saturation = constrain(root["sat"].as<int>(), 0, 254);
         }
     }
     return true;
 }
 
-void LightServiceClass::applyConfigToLightMask(unsigned int lights)
+void LightServiceClass::applyConfigToLightMask(const LightMask& lights)
 {
     String body = HTTP->arg("plain");
     DEBUG_PRINT("applyConfigToLightMask:");
     DEBUG_PRINTLN(body);
-    DynamicJsonBuffer jsonBuffer;
+    RequestJsonBuffer jsonBuffer;
     JsonObject& root = jsonBuffer.parseObject(body);
-    if (root.success()) {
-        for (int i = 0; i < getLightsAvailable(); i++) {
-            LightHandler *handler = getLightHandler(i);
-            LightInfo currentInfo = handler->getInfo(i);
+    if (root.success() && root.containsKey("scene")) {
+        // recall of a stored scene, limited to the lights of the group
+        if (recallScene(root["scene"].as<String>(), lights)) {
+            sendUpdated();
+        } else {
+            sendError(7, "groups/0/action/scene", "Scene not available");
+        }
+    } else if (root.success()) {
+        // only visit the members of the group
+        for (int i = lights.first(); i >= 0 && i < getLightsAvailable(); i = lights.next(i)) {
             LightInfo newInfo;
-            if (parseHueLightInfo(currentInfo, root, &newInfo)) {
-                handler->handleQuery(i, newInfo, root);
+            if (parseHueLightInfo(pLightStates[i], root, &newInfo)) {
+                applyLightState(i, newInfo, root);
             }
         }
         // As per the spec, the response can be "Updated." for memory-constrained devices
@@ -1012,15 +1531,16 @@ void LightServiceClass::groupsIdActionFn(WcFnRequestHandler *handler, String req
     }
     String groupNumText = handler->getWildCard(1);
     int groupNum = atoi(groupNumText.c_str()) - 1;
-    if ((groupNum == -1 && groupNumText != "0") || groupNum >= 16 || (groupNum >= 0 && !pLightGroups[groupNum])) {
+    if ((groupNum == -1 && groupNumText != "0") || groupNum >= MAX_LIGHT_GROUPS || (groupNum >= 0 && !pLightGroups[groupNum])) {
         // error, invalid group number
         sendError(3, requestUri, "Invalid group number");
         return;
     }
     // parse input as if for all lights
-    unsigned int lightMask;
+    LightMask lightMask;
     if (groupNum == -1) {
-        lightMask == 0xFFFF;
+        // group 0 contains all lights
+        lightMask.setAll();
     } else {
         lightMask = pLightGroups[groupNum]->getLightMask();
     }
@@ -1033,14 +1553,15 @@ void LightServiceClass::lightsFn(WcFnRequestHandler *handler, String requestUri,
     switch (method) {
         case HTTP_GET: {
             // dump existing lights
-            DynamicJsonBuffer jsonBuffer;
+            RequestJsonBuffer jsonBuffer;
             JsonObject& lights = jsonBuffer.createObject();
             addLightsJson(lights);
             sendJson(lights);
             break;
         }
         case HTTP_POST:
-            // "start" a "search" for "new" lights
+            // the handlers search in the background, the progress is reported by /lights/new
+            startSearch();
             sendSuccess("/lights", "Searching for new devices");
             break;
         default:
@@ -1060,23 +1581,23 @@ void LightServiceClass::addSingleLightJson(JsonObject& root, int numberOfTheLigh
     root["modelid"] = "LST001";  // the model number
     root["name"] = lightName;  // the name as set through the web UI or app
     JsonObject& state = root.createNestedObject("state");
-    LightInfo info = lightHandler->getInfo(numberOfTheLight);
+    const LightInfo& info = pLightStates[numberOfTheLight];
     state["on"] = info.on;
     state["bri"] = info.brightness;  // brightness between 0-254 (NB 0 is not off!)
-    if (info.bulbType == BulbType::EXTENDED_COLOR_LIGHT) {
+    if (info.getBulbType() == BulbType::EXTENDED_COLOR_LIGHT) {
         state["hue"] = info.hue;  // hs mode: the hue (expressed in ~deg*182.04)
         state["sat"] = info.saturation; // hs mode: saturation between 0-254
         JsonArray& xystate = state.createNestedArray("xy");
         xystate.add(0.0);
         xystate.add(0.0);
         state["ct"] = 500;  // ct mode: color temp (expressed in mireds range 154-500)
-        state["effect"] = info.effect == EFFECT_COLORLOOP ? "colorloop" : "none";
+        state["effect"] = info.getEffect() == EFFECT_COLORLOOP ? "colorloop" : "none";
         state["colormode"] = "hs";  // the current color mode
     }
     state["alert"] = "none";  // 'select' flash the lamp once, 'lselect' repeat flash for 30s
     state["reachable"] = true;  // lamp can be seen by the hub
     root["swversion"] = "0.1";  
-    if (info.bulbType == BulbType::DIMMABLE_LIGHT) {
+    if (info.getBulbType() == BulbType::DIMMABLE_LIGHT) {
         root["type"] = "Dimmable light";
     } else {
         root["type"] = "Extended color light";
@@ -1090,7 +1611,7 @@ void LightServiceClass::lightsIdFn(WcFnRequestHandler *whandler, String requestU
     LightHandler *handler = getLightHandler(numberOfTheLight);
     switch (method) {
         case HTTP_GET: {
-            DynamicJsonBuffer jsonBuffer;
+            RequestJsonBuffer jsonBuffer;
             JsonObject& root = jsonBuffer.createObject();
             addSingleLightJson(root, numberOfTheLight, handler);
             sendJson(root);
@@ -1119,7 +1640,7 @@ void LightServiceClass::lightsIdStateFn(WcFnRequestHandler *whandler, String req
     switch (method) {
         case HTTP_POST:
         case HTTP_PUT: {
-            DynamicJsonBuffer jsonBuffer;
+            RequestJsonBuffer jsonBuffer;
             JsonObject& parsedRoot = jsonBuffer.parseObject(HTTP->arg("plain"));
             DEBUG_PRINTLN("lightsIdStateFn requestUri:" + requestUri);
             DEBUG_PRINTLN("lightsIdStateFn request:" + HTTP->arg("plain"));
@@ -1128,13 +1649,12 @@ void LightServiceClass::lightsIdStateFn(WcFnRequestHandler *whandler, String req
                 sendError(2, requestUri, "Bad JSON body in request" + HTTP->arg("plain"));
                 return;       
             }
-            LightInfo currentInfo = handler->getInfo(numberOfTheLight);
             LightInfo newInfo;
-            if (!parseHueLightInfo(currentInfo, parsedRoot, &newInfo)) {
+            if (!parseHueLightInfo(pLightStates[numberOfTheLight], parsedRoot, &newInfo)) {
                 return;
             }
-            handler->handleQuery(numberOfTheLight, newInfo, parsedRoot);
-            sendJson(generateTargetPutResponse(parsedRoot, "/lights/" + whandler->getWildCard(1) + "/state/"));
+            applyLightState(numberOfTheLight, newInfo, parsedRoot);
+            sendTargetPutResponse(parsedRoot, "/lights/" + whandler->getWildCard(1) + "/state/");
             break;
         }
         default:
@@ -1143,12 +1663,75 @@ void LightServiceClass::lightsIdStateFn(WcFnRequestHandler *whandler, String req
     }
 }
 
+void LightServiceClass::startSearch()
+{
+    for (int i = 0; i < getLightsAvailable(); i++) {
+        if (pLightHandlers[i]) {
+            pLightHandlers[i]->startSearch(i);
+        }
+    }
+    pSearchActive = true;
+    pSearchStartMs = millis();
+}
+
+// remembers the end of the search for "lastscan", the search ends after SEARCH_TIMEOUT_MS
+// even if a handler still listens
+void LightServiceClass::updateSearch()
+{
+    if (millis() - pSearchStartMs <= SEARCH_TIMEOUT_MS) {
+        for (int i = 0; i < getLightsAvailable(); i++) {
+            if (pLightHandlers[i] && pLightHandlers[i]->getSearchState(i) == SEARCH_ACTIVE) {
+                return;
+            }
+        }
+    }
+    pSearchActive = false;
+    pLastScan = time(nullptr);
+}
+
 void LightServiceClass::lightsNewFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
 {
-    // dump empty object
-    DynamicJsonBuffer jsonBuffer;
-    JsonObject& lights = jsonBuffer.createObject();
-    sendJson(lights);
+    switch (method) {
+        case HTTP_GET: {
+            // {"lastscan": "active"} while searching, the lights found by the last search
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& lights = jsonBuffer.createObject();
+            char lastscan[24];
+            for (int i = 0; i < getLightsAvailable(); i++) {
+                if (pLightHandlers[i] && pLightHandlers[i]->getSearchState(i) == SEARCH_FOUND) {
+                    JsonObject& light = lights.createNestedObject(String(i + 1));
+                    light["name"] = pLightHandlers[i]->getFriendlyName(i);
+                }
+            }
+            if (pSearchActive) {
+                lights["lastscan"] = "active";
+            } else {
+                formatTime(lastscan, sizeof(lastscan), pLastScan);
+                lights["lastscan"] = lastscan;  // char* is copied into the buffer
+            }
+            sendJson(lights);
+            break;
+        }
+        case HTTP_POST:
+            startSearch();
+            sendSuccess("/lights", "Searching for new devices");
+            break;
+        case HTTP_DELETE:
+            // not in the Hue API, stops a running search
+            for (int i = 0; i < getLightsAvailable(); i++) {
+                if (pLightHandlers[i]) {
+                    pLightHandlers[i]->stopSearch(i);
+                }
+            }
+            if (pSearchActive) {
+                updateSearch();
+            }
+            sendSuccess("/lights/new stopped");
+            break;
+        default:
+            sendError(4, requestUri, "Light method not supported");
+            break;
+    }
 }
 
 
@@ -1197,10 +1780,10 @@ rgbcolor LightServiceClass::getXYtoRGB(float x, float y, int brightness_raw)
     b = 1.0f;
   }
 
-  // Apply gamma correction
-  r = r <= 0.0031308f ? 12.92f * r : (1.0f + 0.055f) * pow(r, (1.0f / 2.4f)) - 0.055f;
-  g = g <= 0.0031308f ? 12.92f * g : (1.0f + 0.055f) * pow(g, (1.0f / 2.4f)) - 0.055f;
-  b = b <= 0.0031308f ? 12.92f * b : (1.0f + 0.055f) * pow(b, (1.0f / 2.4f)) - 0.055f;
+  // Apply gamma correction (table lookup, see HueColorTables.h)
+  r = gammaCorrect(r);
+  g = gammaCorrect(g);
+  b = gammaCorrect(b);
 
   if (r > b && r > g) {
     // red is biggest
@@ -1236,42 +1819,28 @@ rgbcolor LightServiceClass::getXYtoRGB(float x, float y, int brightness_raw)
                   b * COLOR_SATURATION);
 }
 
-int LightServiceClass::getHue(hsvcolor hsb)
+int LightServiceClass::getHue(const hsvcolor& hsb)
 {
-  return hsb.h * 360 * 182.04;
+  return hsb.h;
 }
 
-int LightServiceClass::getSaturation(hsvcolor hsb)
+int LightServiceClass::getSaturation(const hsvcolor& hsb)
 {
-  return hsb.s * COLOR_SATURATION;
+  return hsb.s;
 }
 
 rgbcolor LightServiceClass::getMirektoRGB(int mirek)
 {
-  int hectemp = 10000 / mirek;
-  int r, g, b;
-  if (hectemp <= 66) {
-    r = COLOR_SATURATION;
-    g = 99.4708025861 * log(hectemp) - 161.1195681661;
-    b = hectemp <= 19 ? 0 : (138.5177312231 * log(hectemp - 10) - 305.0447927307);
-  } else {
-    r = 329.698727446 * pow(hectemp - 60, -0.1332047592);
-    g = 288.1221695283 * pow(hectemp - 60, -0.0755148492);
-    b = COLOR_SATURATION;
-  }
-  r = r > COLOR_SATURATION ? COLOR_SATURATION : r;
-  g = g > COLOR_SATURATION ? COLOR_SATURATION : g;
-  b = b > COLOR_SATURATION ? COLOR_SATURATION : b;
-  return rgbcolor(r, g, b);
+  // precomputed from the formulas of Tanner Helland, see HueColorTables.h
+  return mirekToRGB(mirek);
 }
 
 // check the file system and restore group slots from them
 void LightServiceClass::initializeGroupSlots()
 {
     DEBUG_PRINTLN("initializeGroupSlots()");
-    for (int i = 0; i < 16; i++) {
-        String fileName = GROUP_FILE_TEMPLATE;
-        fileName.replace("%d",String(i));
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
+        String fileName = slotFileName(GROUP_FILE_TEMPLATE, i);
         //DEBUG_PRINT("Testing for ");
         //DEBUG_PRINTLN(fileName);
         if (SPIFFS.exists(fileName)) {   
@@ -1289,7 +1858,10 @@ void LightServiceClass::initializeGroupSlots()
                 } else {
                     DEBUG_PRINT("Loading ");
                     DEBUG_PRINTLN(fileName);
-                    pLightGroups[i] = new LightGroup(root);
+                    pLightGroups[i] = pGroupPool.allocate(root);
+                    if (pLightGroups[i]) {
+                        indexGroupSlot(i, true);
+                    }
                 }
                 f.close();
             } else {
@@ -1305,9 +1877,8 @@ void LightServiceClass::initializeGroupSlots()
 void LightServiceClass::initializeSceneSlots()
 {
     DEBUG_PRINTLN("initializeSceneSlots()");
-    for (int i = 0; i < 16; i++) {
-        String fileName = SCENE_FILE_TEMPLATE;
-        fileName.replace("%d",String(i));
+    for (int i = 0; i < MAX_LIGHT_GROUPS; i++) {
+        String fileName = slotFileName(SCENE_FILE_TEMPLATE, i);
         //DEBUG_PRINT("Testing for ");DEBUG_PRINTLN(fileName);
         if (SPIFFS.exists(fileName)) {   
             // read the file into the groupslot position
@@ -1324,8 +1895,15 @@ void LightServiceClass::initializeSceneSlots()
                 } else {
                     DEBUG_PRINT("Loading ");
                     DEBUG_PRINTLN(fileName);
-                    pLightScenes[i] = new LightGroup(root);
-                    pLightScenes[i]->id = String(i,DEC);
+                    pLightScenes[i] = pGroupPool.allocate(root);
+                    if (pLightScenes[i]) {
+                        pLightScenes[i]->setId(String(i, DEC).c_str());
+                        if (!loadSceneStates(i, root)) {
+                            DEBUG_PRINTLN("Scene light states full");
+                            pGroupPool.release(pLightScenes[i]);
+                            pLightScenes[i] = nullptr;
+                        }
+                    }
                 }
                 f.close();
             } else {
@@ -1349,3 +1927,233 @@ String methodToString(int method) {
   }
 }
 
+// ISO 8601 as used in the Hue API, "none" until the clock is set by NTP
+void LightServiceClass::formatTime(char *buffer, size_t size, time_t timestamp)
+{
+    if (!ntpSet || timestamp == 0) {
+        strlcpy(buffer, "none", size);
+        return;
+    }
+    struct tm *timeinfo = gmtime(&timestamp);
+    strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", timeinfo);
+}
+
+// sensor 1 is the presence, sensor 2 the light level of the motion detector
+bool LightServiceClass::addSensorJson(JsonObject& root, int numberOfTheSensor)
+{
+    char updated[24];
+    String uniqueid = String(pIdentity.mac) + "-" + numberOfTheSensor;
+    JsonObject& state = root.createNestedObject("state");
+    JsonObject& config = root.createNestedObject("config");
+    if (numberOfTheSensor == 1) {
+        root["type"] = "ZLLPresence";
+        root["name"] = "Motion sensor";
+        root["modelid"] = "SML001";
+        state["presence"] = pSensorState.presence;
+        formatTime(updated, sizeof(updated), pSensorState.presenceUpdated);
+    } else if (numberOfTheSensor == 2) {
+        root["type"] = "ZLLLightLevel";
+        root["name"] = "Light level";
+        root["modelid"] = "SML001";
+        state["lightlevel"] = pSensorState.lightlevel;
+        state["dark"] = pSensorState.dark;
+        state["daylight"] = !pSensorState.dark;
+        config["tholddark"] = pSensorState.tholddark;
+        config["tholdoffset"] = 0;
+        formatTime(updated, sizeof(updated), pSensorState.lightlevelUpdated);
+    } else {
+        return false;
+    }
+    state["lastupdated"] = updated;  // char* is copied into the buffer
+    // the remote switches the motion detection off for a while
+    config["on"] = !pSensorState.suppressed;
+    config["reachable"] = true;
+    if (pSensorState.suppressed) {
+        config["suppressedseconds"] = pSensorState.suppressedSeconds;
+    }
+    root["manufacturername"] = "OpenSource";
+    root["swversion"] = "0.1";
+    root["uniqueid"] = uniqueid;
+    return true;
+}
+
+// the readings come from the snapshot, the hardware is not read here
+void LightServiceClass::addSensorsJson(JsonObject& root)
+{
+    if (pSensorVersion != 0) {
+        addSensorJson(root.createNestedObject("1"), 1);
+        addSensorJson(root.createNestedObject("2"), 2);
+    }
+}
+
+void LightServiceClass::sensorsFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
+{
+    RequestJsonBuffer jsonBuffer;
+    JsonObject& root = jsonBuffer.createObject();
+    addSensorsJson(root);
+    sendJson(root);
+}
+
+void LightServiceClass::sensorsIdFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
+{
+    int numberOfTheSensor = atoi(handler->getWildCard(1).c_str());
+    RequestJsonBuffer jsonBuffer;
+    JsonObject& root = jsonBuffer.createObject();
+    if (pSensorVersion == 0 || !addSensorJson(root, numberOfTheSensor)) {
+        sendError(3, requestUri, "Sensor not available");
+        return;
+    }
+    sendJson(root);
+}
+
+void LightServiceClass::schedulesFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
+{
+    switch (method) {
+        case HTTP_GET: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& root = jsonBuffer.createObject();
+            pSchedules.fillAllJson(root);
+            sendJson(root);
+            break;
+        }
+        case HTTP_POST: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& body = jsonBuffer.parseObject(HTTP->arg("plain"));
+            if (!body.success()) {
+                sendError(2, "/schedules", "Bad JSON body in request");
+                return;
+            }
+            const char *error = NULL;
+            int id = pSchedules.create(body, &error);
+            if (error) {
+                sendError(7, "/schedules", error);
+            } else if (id == 0) {
+                sendError(301, "/schedules", "Schedules table full");
+            } else {
+                sendSuccess("id", String(id));
+            }
+            break;
+        }
+        default:
+            sendError(4, requestUri, "Schedule method not supported");
+            break;
+    }
+}
+
+void LightServiceClass::schedulesIdFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
+{
+    int id = atoi(handler->getWildCard(1).c_str());
+    switch (method) {
+        case HTTP_GET: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& root = jsonBuffer.createObject();
+            if (!pSchedules.fillJson(id, root)) {
+                sendError(3, requestUri, "Schedule not available");
+                return;
+            }
+            sendJson(root);
+            break;
+        }
+        case HTTP_PUT: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& body = jsonBuffer.parseObject(HTTP->arg("plain"));
+            if (!body.success()) {
+                sendError(2, requestUri, "Bad JSON body in request");
+                return;
+            }
+            const char *error = NULL;
+            if (!pSchedules.change(id, body, &error)) {
+                sendError(error ? 7 : 3, requestUri, error ? error : "Schedule not available");
+                return;
+            }
+            sendTargetPutResponse(body, "/schedules/" + handler->getWildCard(1) + "/");
+            break;
+        }
+        case HTTP_DELETE:
+            if (!pSchedules.remove(id)) {
+                sendError(3, requestUri, "Schedule not available");
+                return;
+            }
+            sendSuccess("/schedules/" + handler->getWildCard(1) + " deleted");
+            break;
+        default:
+            sendError(4, requestUri, "Schedule method not supported");
+            break;
+    }
+}
+
+void LightServiceClass::rulesFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
+{
+    switch (method) {
+        case HTTP_GET: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& root = jsonBuffer.createObject();
+            pRules.fillAllJson(root);
+            sendJson(root);
+            break;
+        }
+        case HTTP_POST: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& body = jsonBuffer.parseObject(HTTP->arg("plain"));
+            if (!body.success()) {
+                sendError(2, "/rules", "Bad JSON body in request");
+                return;
+            }
+            const char *error = NULL;
+            int id = pRules.create(body, &error);
+            if (error) {
+                sendError(7, "/rules", error);
+            } else if (id == 0) {
+                sendError(301, "/rules", "Rules table full");
+            } else {
+                sendSuccess("id", String(id));
+            }
+            break;
+        }
+        default:
+            sendError(4, requestUri, "Rule method not supported");
+            break;
+    }
+}
+
+void LightServiceClass::rulesIdFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method)
+{
+    int id = atoi(handler->getWildCard(1).c_str());
+    switch (method) {
+        case HTTP_GET: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& root = jsonBuffer.createObject();
+            if (!pRules.fillJson(id, root)) {
+                sendError(3, requestUri, "Rule not available");
+                return;
+            }
+            sendJson(root);
+            break;
+        }
+        case HTTP_PUT: {
+            RequestJsonBuffer jsonBuffer;
+            JsonObject& body = jsonBuffer.parseObject(HTTP->arg("plain"));
+            if (!body.success()) {
+                sendError(2, requestUri, "Bad JSON body in request");
+                return;
+            }
+            const char *error = NULL;
+            if (!pRules.change(id, body, &error)) {
+                sendError(error ? 7 : 3, requestUri, error ? error : "Rule not available");
+                return;
+            }
+            sendTargetPutResponse(body, "/rules/" + handler->getWildCard(1) + "/");
+            break;
+        }
+        case HTTP_DELETE:
+            if (!pRules.remove(id)) {
+                sendError(3, requestUri, "Rule not available");
+                return;
+            }
+            sendSuccess("/rules/" + handler->getWildCard(1) + " deleted");
+            break;
+        default:
+            sendError(4, requestUri, "Rule method not supported");
+            break;
+    }
+}
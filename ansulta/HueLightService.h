@@ -22,13 +22,25 @@ https://github.com/probonopd/ESP8266HueEmulator
 #include "HueTypes.h"
 #include "HueWcFnRequestHandler.h"
 #include "HueLightGroup.h"
+#include "HueUdpControl.h"
+#include "HueSchedules.h"
+#include "HueRules.h"
 
 namespace hue {
 
-#define MAX_LIGHT_HANDLERS 16
-#define MAX_LIGHT_GROUPS 16
 #define COLOR_SATURATION 255.0f
 #define WEB_PORT 80
+#define MAX_EVENT_CLIENTS 4  // connections to /eventstream
+#define EVENT_KEEPALIVE_MS 15000
+
+// network identity of the bridge, fixed size to keep it off the heap
+struct BridgeIdentity {
+    char bridgeID[17];  // MAC without colons, FFFE inserted in the middle
+    char mac[18];
+    char ip[16];
+    char netmask[16];
+    char gateway[16];
+};
 
 class LightServiceClass : public LightServiceInterface {
 
@@ -43,35 +55,86 @@ public:
     void begin(ESP8266WebServer *svr);
     void update();
     void ntp_available(bool state);
+    // state cache: the handlers report each change of their lights here
+    void notifyLightState(int numberOfTheLight, const LightInfo& info);
+    const LightInfo& getLightState(int numberOfTheLight);
+    uint32_t getStateVersion();
+    LightMask changedSince(uint32_t version);
+    // passes a new state to the handler of the light, used by the Hue API and the UDP control
+    bool applyLightState(int numberOfTheLight, const LightInfo& newInfo, JsonObject& raw);
+    void setUdpToken(uint32_t token);
+    // executes a command of a schedule or rule on a light or group
+    void applyAction(const LightAction& action);
+    // motion and light level sensor, /sensors is empty until the first notify
+    void notifySensorState(const SensorState& state);
+    const SensorState& getSensorState();
+    uint32_t getSensorVersion();
 protected:
     int pCurrentNumLights;
     static LightHandler* pLightHandlers[MAX_LIGHT_HANDLERS]; // interfaces exposed to the outside world
     static LightGroup* pLightGroups[MAX_LIGHT_GROUPS];
     static LightGroup* pLightScenes[MAX_LIGHT_GROUPS];
+    static LightGroupPool<2 * MAX_LIGHT_GROUPS> pGroupPool; // records for pLightGroups and pLightScenes
+    static LightInfo pLightStates[MAX_LIGHT_HANDLERS]; // cached state of each light, read by the serializers
+    static LightInfo pSceneStates[MAX_SCENE_LIGHT_STATES]; // target states of the scenes, a scene owns the consecutive entries of its members
+    static int pSceneStatesUsed;
+    static uint32_t pLightVersions[MAX_LIGHT_HANDLERS]; // value of pStateVersion at the last change of the light
+    static GroupMask pLightMemberships[MAX_LIGHT_HANDLERS]; // groups containing the light
+    // aggregate of group 0 over the lights reported by their handlers
+    uint8_t pAllCount;
+    uint8_t pAllOnCount;
+    uint16_t pAllBriSum;
+    uint32_t pStateVersion;
+    SensorState pSensorState;
+    uint32_t pSensorVersion;
+    uint32_t pSensorEventVersion; // sensor version already pushed to the event stream
     ESP8266WebServer *HTTP;
-    String friendlyName;
-    String bridgeIDString;
-    String macString;
-    String ipString;
-    String netmaskString;
-    String gatewayString;
+    std::vector<WcFnRequestHandler*> pRouteHandlers; // registered API routes, used for metrics
+    BridgeIdentity pIdentity;
     bool ntpSet;
+    bool pSearchActive;   // a search for new lights was started by POST /lights
+    time_t pLastScan;     // end of the last search
+    unsigned long pSearchStartMs;
+    WiFiClient pEventClients[MAX_EVENT_CLIENTS]; // Server-Sent Events subscribers
+    uint32_t pEventVersion; // state version already pushed to the subscribers
+    unsigned long pEventKeepaliveMs;
+    UdpControlClass pUdpControl;
+    ScheduleStore pSchedules;
+    RuleEngine pRules;
+    // the rules see the changes in update(), the actions would otherwise report back into the evaluation
+    uint32_t pRulesVersion;        // state version already passed to the rules
+    LightInfo pRulesLightStates[MAX_LIGHT_HANDLERS]; // light states at pRulesVersion
+    uint32_t pRulesSensorVersion;  // sensor version already passed to the rules
+    SensorState pRulesSensorState; // sensor state at pRulesSensorVersion
 
     void on(WcFnHandlerFunction fn, const String &wcUri, HTTPMethod method, char wildcard = '*');
     
-    String listFiles(String _template);
-    void clearFiles(String _template);
+    String listFiles(PGM_P fileTemplate);
+    void clearFiles(PGM_P fileTemplate);
 
-    void indexPageFn();
-    void cacheClearFn();
-    void descriptionFn();
+    void indexPageFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void cacheClearFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void descriptionFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void metricsFn();
+    void captureFn();
+    void eventStreamFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    bool writeEvent(WiFiClient& client, const char *event, size_t length);
+    void broadcastEvent(const char *event, size_t length);
+    size_t formatLightEvent(char *buffer, size_t size, int numberOfTheLight);
+    void pushLightEvents();
+    void pushChangeEvent(const char *event, int id, bool deleted);
+    void pushSensorEvent();
+    void passRuleEvents();
+#ifdef TRACE
+    void traceFn();
+#endif
     void unimpFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
-    String generateTargetPutResponse(JsonObject &body, String targetBase);
+    void sendTargetPutResponse(JsonObject &body, String targetBase);
     
     void addConfigJson(JsonObject& config);
-    void sendJson(String msg);
     void sendJson(JsonObject& config);
     void sendJson(JsonArray& config);
+    void sendBuffer(const char *contentType, const char *msg, size_t length);
     void sendError(int type, String path, String description);
     void sendSuccess(String name, String value);
     void sendSuccess(String value);
@@ -88,6 +151,13 @@ protected:
     int findSceneIndex(String id);
     bool validateGroupCreateBody(JsonObject& root);
     bool updateSceneSlot(int slot, String id, String body);
+    void clearSceneSlot(int slot);
+    bool loadSceneStates(int slot, JsonObject& root);
+    void releaseSceneStates(int slot);
+    LightInfo* sceneStates(int slot);
+    LightInfo& sceneState(int slot, int light);
+    void saveSceneSlot(int slot);
+    bool recallScene(String id, const LightMask& lights);
     void sceneCreationHandler(String id);
     String scenePutHandler(String id);
     void scenesFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
@@ -96,20 +166,33 @@ protected:
     void scenesIdLightFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
     void groupListingHandler();
     bool updateGroupSlot(int slot, String body);
+    void clearGroupSlot(int slot);
+    void indexGroupSlot(int slot, bool add);
     void groupCreationHandler();
     void groupsFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
     void groupsIdFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
-    bool parseHueLightInfo(LightInfo currentInfo, JsonObject& root, LightInfo *newInfo);
-    void applyConfigToLightMask(unsigned int lights);
+    bool parseHueLightInfo(const LightInfo& currentInfo, JsonObject& root, LightInfo *newInfo);
+    void applyConfigToLightMask(const LightMask& lights);
     void groupsIdActionFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
     void lightsFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
     void addSingleLightJson(JsonObject& root, int numberOfTheLight, LightHandler* lightHandler);
     void lightsIdFn(WcFnRequestHandler *whandler, String requestUri, HTTPMethod method);
     void lightsIdStateFn(WcFnRequestHandler *whandler, String requestUri, HTTPMethod method);
     void lightsNewFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void startSearch();
+    void updateSearch();
+    void formatTime(char *buffer, size_t size, time_t timestamp);
+    bool addSensorJson(JsonObject& root, int numberOfTheSensor);
+    void addSensorsJson(JsonObject& root);
+    void sensorsFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void sensorsIdFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void schedulesFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void schedulesIdFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void rulesFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
+    void rulesIdFn(WcFnRequestHandler *handler, String requestUri, HTTPMethod method);
     rgbcolor getXYtoRGB(float x, float y, int brightness_raw);
-    int getHue(hsvcolor hsb);
-    int getSaturation(hsvcolor hsb);
+    int getHue(const hsvcolor& hsb);
+    int getSaturation(const hsvcolor& hsb);
     rgbcolor getMirektoRGB(int mirek);
     void initializeGroupSlots();
     void initializeSceneSlots();
@@ -0,0 +1,55 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Preallocated memory shared by all JSON documents and response
+buffers of one HTTP request. The arena is reset in O(1) after
+the request, so steady polling does not fragment the heap.
+
+**************************************************************/
+#include "HueRequestArena.h"
+#include "debug.h"
+
+using namespace hue;
+
+RequestArena hue::requestArena;
+
+RequestArena::RequestArena()
+{
+    pUsed = 0;
+    pHighWater = 0;
+    pFallbackCount = 0;
+}
+
+void* RequestArena::allocate(size_t size)
+{
+    size = (size + 3) & ~3;
+    if (pUsed + size > sizeof(pBuffer)) {
+        DEBUG_PRINTLN("Request arena exhausted, use malloc");
+        pFallbackCount++;
+        return malloc(size);
+    }
+    void* pointer = (uint8_t*)pBuffer + pUsed;
+    pUsed += size;
+    if (pUsed > pHighWater) {
+        pHighWater = pUsed;
+    }
+    return pointer;
+}
+
+void RequestArena::deallocate(void* pointer)
+{
+    uint8_t* address = (uint8_t*)pointer;
+    if (address < (uint8_t*)pBuffer || address >= (uint8_t*)pBuffer + sizeof(pBuffer)) {
+        free(pointer);
+    }
+}
+
+void RequestArena::reset()
+{
+    pUsed = 0;
+}
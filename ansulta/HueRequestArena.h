@@ -0,0 +1,56 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Preallocated memory shared by all JSON documents and response
+buffers of one HTTP request. The arena is reset in O(1) after
+the request, so steady polling does not fragment the heap.
+
+**************************************************************/
+#ifndef HUEREQUESTARENA_H
+#define HUEREQUESTARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+namespace hue {
+
+#define REQUEST_ARENA_SIZE 6144
+
+class RequestArena {
+  public:
+    RequestArena();
+    /** Returns 4 byte aligned memory, falls back to malloc if the arena is exhausted. */
+    void* allocate(size_t size);
+    /** Only memory from the fallback is freed, arena memory is released by reset(). */
+    void deallocate(void* pointer);
+    /** Releases all arena memory. Must only be called if no allocation is used anymore. */
+    void reset();
+    size_t capacity() const { return REQUEST_ARENA_SIZE; }
+    size_t highWater() const { return pHighWater; }
+    uint32_t fallbackCount() const { return pFallbackCount; }
+
+  protected:
+    uint32_t pBuffer[REQUEST_ARENA_SIZE / sizeof(uint32_t)];
+    size_t pUsed;
+    size_t pHighWater;
+    uint32_t pFallbackCount;
+};
+
+extern RequestArena requestArena;
+
+// allocator interface of ArduinoJson
+struct RequestArenaAllocator {
+  void* allocate(size_t size) { return requestArena.allocate(size); }
+  void deallocate(void* pointer) { requestArena.deallocate(pointer); }
+};
+
+// use it like the DynamicJsonBuffer inside of the request handlers
+typedef ArduinoJson::Internals::DynamicJsonBufferBase<RequestArenaAllocator> RequestJsonBuffer;
+
+};
+#endif
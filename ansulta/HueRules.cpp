@@ -0,0 +1,491 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Local rules of the Hue API evaluated on the events of their sources.
+
+**************************************************************/
+#include "HueRules.h"
+#include <FS.h>
+#include <time.h>
+#include "debug.h"
+
+using namespace hue;
+
+// before NTP the clock counts from 1970
+#define RULE_MIN_VALID_TIME 1500000000UL
+
+RuleEngine::RuleEngine()
+{
+    memset(pRules, 0, sizeof(pRules));
+    pSensor = NULL;
+    pLights = NULL;
+    pClockTime = 0;
+}
+
+void RuleEngine::begin(const SensorState *sensor, const LightInfo *lights, ActionFunction fn)
+{
+    pSensor = sensor;
+    pLights = lights;
+    pAction = fn;
+    load();
+    buildDependencies();
+}
+
+void RuleEngine::onEvent(int source)
+{
+    if (source < 0 || source >= RULE_SOURCES) {
+        return;
+    }
+    const RuleMask& rules = pDependencies[source];
+    for (int i = rules.first(); i >= 0; i = rules.next(i)) {
+        Rule& rule = pRules[i];
+        bool result = true;
+        bool changed = false;
+        for (int c = 0; c < rule.conditionCount && result; c++) {
+            result = test(rule.conditions[c], source);
+            changed |= result && rule.conditions[c].op == RULE_OP_DX;
+        }
+        // a matching dx is an edge itself, the other rules trigger when they become true
+        bool triggered = result && (changed || !pResults.test(i));
+        if (result) {
+            pResults.set(i);
+        } else {
+            pResults.clear(i);
+        }
+        if (!triggered) {
+            continue;
+        }
+        DEBUG_PRINT("rule triggered: ");
+        DEBUG_PRINTLN(rule.name);
+        // the counters are only kept in RAM, writing the flash on each trigger would wear it out
+        rule.timesTriggered++;
+        rule.lastTriggered = time(nullptr);
+        for (int a = 0; a < rule.actionCount; a++) {
+            if (pAction) {
+                pAction(rule.actions[a]);
+            }
+        }
+    }
+}
+
+void RuleEngine::update()
+{
+    if (!pDependencies[RULE_SOURCE_CLOCK].any()) {
+        return;
+    }
+    uint32_t now = time(nullptr);
+    if (now != pClockTime && now > RULE_MIN_VALID_TIME) {
+        pClockTime = now;
+        onEvent(RULE_SOURCE_CLOCK);
+    }
+}
+
+int RuleEngine::create(JsonObject& body, const char **error)
+{
+    *error = NULL;
+    int index = -1;
+    for (int i = 0; i < MAX_RULES; i++) {
+        if (!(pRules[i].flags & RULE_FLAG_USED)) {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1) {
+        return 0;
+    }
+    if (!parse(body, pRules[index], true, error)) {
+        memset(&pRules[index], 0, sizeof(Rule));
+        return 0;
+    }
+    pResults.clear(index);
+    buildDependencies();
+    save();
+    return index + 1;
+}
+
+bool RuleEngine::change(int id, JsonObject& body, const char **error)
+{
+    *error = NULL;
+    int index = id - 1;
+    if (index < 0 || index >= MAX_RULES || !(pRules[index].flags & RULE_FLAG_USED)) {
+        return false;
+    }
+    Rule rule = pRules[index];
+    if (!parse(body, rule, false, error)) {
+        return false;
+    }
+    pRules[index] = rule;
+    pResults.clear(index);
+    buildDependencies();
+    save();
+    return true;
+}
+
+bool RuleEngine::remove(int id)
+{
+    int index = id - 1;
+    if (index < 0 || index >= MAX_RULES || !(pRules[index].flags & RULE_FLAG_USED)) {
+        return false;
+    }
+    memset(&pRules[index], 0, sizeof(Rule));
+    pResults.clear(index);
+    buildDependencies();
+    save();
+    return true;
+}
+
+bool RuleEngine::fillJson(int id, JsonObject& root)
+{
+    int index = id - 1;
+    if (index < 0 || index >= MAX_RULES || !(pRules[index].flags & RULE_FLAG_USED)) {
+        return false;
+    }
+    const Rule& rule = pRules[index];
+    root["name"] = rule.name;
+    root["owner"] = "api";
+    if (rule.lastTriggered != 0) {
+        char lasttriggered[24];
+        time_t last = rule.lastTriggered;
+        strftime(lasttriggered, sizeof(lasttriggered), "%Y-%m-%dT%H:%M:%S", gmtime(&last));
+        root["lasttriggered"] = lasttriggered;  // char* is copied into the buffer
+    } else {
+        root["lasttriggered"] = "none";
+    }
+    root["timestriggered"] = rule.timesTriggered;
+    root["status"] = (rule.flags & RULE_FLAG_ENABLED) ? "enabled" : "disabled";
+    JsonArray& conditions = root.createNestedArray("conditions");
+    for (int c = 0; c < rule.conditionCount; c++) {
+        fillConditionJson(rule.conditions[c], conditions.createNestedObject());
+    }
+    JsonArray& actions = root.createNestedArray("actions");
+    for (int a = 0; a < rule.actionCount; a++) {
+        fillLightActionJson(rule.actions[a], actions.createNestedObject());
+    }
+    return true;
+}
+
+void RuleEngine::fillAllJson(JsonObject& root)
+{
+    for (int i = 0; i < MAX_RULES; i++) {
+        if (pRules[i].flags & RULE_FLAG_USED) {
+            fillJson(i + 1, root.createNestedObject(String(i + 1)));
+        }
+    }
+}
+
+bool RuleEngine::parse(JsonObject& body, Rule& rule, bool create, const char **error)
+{
+    if (create) {
+        memset(&rule, 0, sizeof(Rule));
+        rule.flags = RULE_FLAG_USED | RULE_FLAG_ENABLED;
+        strlcpy(rule.name, "rule", sizeof(rule.name));
+    }
+    const char *name = body["name"];
+    if (name) {
+        strlcpy(rule.name, name, sizeof(rule.name));
+    }
+    if (body.containsKey("conditions")) {
+        JsonArray& conditions = body["conditions"];
+        if (!conditions.success() || conditions.size() == 0 || conditions.size() > MAX_RULE_CONDITIONS) {
+            *error = "invalid value for parameter, conditions";
+            return false;
+        }
+        rule.conditionCount = conditions.size();
+        for (int c = 0; c < rule.conditionCount; c++) {
+            if (!parseCondition(conditions[c], rule.conditions[c])) {
+                *error = "invalid value for parameter, conditions";
+                return false;
+            }
+        }
+    } else if (create) {
+        *error = "missing parameters in body, conditions";
+        return false;
+    }
+    if (body.containsKey("actions")) {
+        JsonArray& actions = body["actions"];
+        if (!actions.success() || actions.size() == 0 || actions.size() > MAX_RULE_ACTIONS) {
+            *error = "invalid value for parameter, actions";
+            return false;
+        }
+        rule.actionCount = actions.size();
+        for (int a = 0; a < rule.actionCount; a++) {
+            if (!parseLightAction(actions[a], rule.actions[a])) {
+                *error = "invalid value for parameter, actions";
+                return false;
+            }
+        }
+    } else if (create) {
+        *error = "missing parameters in body, actions";
+        return false;
+    }
+    const char *status = body["status"];
+    if (status) {
+        if (strcmp(status, "enabled") == 0) {
+            rule.flags |= RULE_FLAG_ENABLED;
+        } else if (strcmp(status, "disabled") == 0) {
+            rule.flags &= ~RULE_FLAG_ENABLED;
+        } else {
+            *error = "invalid value for parameter, status";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RuleEngine::parseCondition(JsonObject& json, RuleCondition& condition)
+{
+    memset(&condition, 0, sizeof(condition));
+    const char *address = json["address"];
+    const char *op = json["operator"];
+    const char *value = json["value"];
+    if (!address || !op) {
+        return false;
+    }
+    if (strcmp(op, "eq") == 0) {
+        condition.op = RULE_OP_EQ;
+    } else if (strcmp(op, "gt") == 0) {
+        condition.op = RULE_OP_GT;
+    } else if (strcmp(op, "lt") == 0) {
+        condition.op = RULE_OP_LT;
+    } else if (strcmp(op, "dx") == 0) {
+        condition.op = RULE_OP_DX;
+    } else if (strcmp(op, "in") == 0) {
+        condition.op = RULE_OP_IN;
+    } else if (strcmp(op, "not in") == 0) {
+        condition.op = RULE_OP_NOT_IN;
+    } else {
+        return false;
+    }
+    bool window = condition.op == RULE_OP_IN || condition.op == RULE_OP_NOT_IN;
+    unsigned int id = 0;
+    char attribute[16];
+    int end = 0;
+    if (strcmp(address, "/config/localtime") == 0) {
+        unsigned int a, b, c, d, e, f;
+        if (!window || !value || sscanf(value, "T%u:%u:%u/T%u:%u:%u%n", &a, &b, &c, &d, &e, &f, &end) != 6
+            || value[end] != '\0' || a > 23 || b > 59 || c > 59 || d > 23 || e > 59 || f > 59) {
+            return false;
+        }
+        condition.source = RULE_SOURCE_CLOCK;
+        condition.attribute = RULE_ATTR_LOCALTIME;
+        condition.value = a * 3600 + b * 60 + c;
+        condition.value2 = d * 3600 + e * 60 + f;
+        return true;
+    }
+    if (window) {
+        return false;
+    }
+    if (sscanf(address, "/sensors/%u/state/%15s", &id, attribute) == 2) {
+        if (id == 1 && strcmp(attribute, "presence") == 0) {
+            condition.attribute = RULE_ATTR_PRESENCE;
+        } else if (id == 1 && strcmp(attribute, "lastupdated") == 0 && condition.op == RULE_OP_DX) {
+            condition.attribute = RULE_ATTR_LASTUPDATED;
+        } else if (id == 2 && strcmp(attribute, "lightlevel") == 0) {
+            condition.attribute = RULE_ATTR_LIGHTLEVEL;
+        } else if (id == 2 && strcmp(attribute, "dark") == 0) {
+            condition.attribute = RULE_ATTR_DARK;
+        } else if (id == 2 && strcmp(attribute, "daylight") == 0) {
+            condition.attribute = RULE_ATTR_DAYLIGHT;
+        } else if (id == 2 && strcmp(attribute, "lastupdated") == 0 && condition.op == RULE_OP_DX) {
+            condition.attribute = RULE_ATTR_LASTUPDATED;
+        } else {
+            return false;
+        }
+        condition.source = id == 1 ? RULE_SOURCE_PRESENCE : RULE_SOURCE_LIGHTLEVEL;
+    } else if (sscanf(address, "/lights/%u/state/%15s", &id, attribute) == 2) {
+        if (id < 1 || id > MAX_LIGHT_HANDLERS) {
+            return false;
+        }
+        if (strcmp(attribute, "on") == 0) {
+            condition.attribute = RULE_ATTR_ON;
+        } else if (strcmp(attribute, "bri") == 0) {
+            condition.attribute = RULE_ATTR_BRI;
+        } else {
+            return false;
+        }
+        condition.source = RULE_SOURCE_LIGHT + id - 1;
+    } else {
+        return false;
+    }
+    if (condition.op == RULE_OP_DX) {
+        return true;
+    }
+    // the boolean attributes only support eq
+    bool boolean = condition.attribute != RULE_ATTR_LIGHTLEVEL && condition.attribute != RULE_ATTR_BRI;
+    if (boolean && condition.op != RULE_OP_EQ) {
+        return false;
+    }
+    // the value is a string in the Hue API, but some clients send the JSON type
+    if (boolean && json["value"].is<bool>()) {
+        condition.value = json["value"].as<bool>();
+    } else if (!boolean && json["value"].is<long>()) {
+        condition.value = json["value"].as<long>();
+    } else if (!value) {
+        return false;
+    } else if (boolean) {
+        if (strcmp(value, "true") == 0) {
+            condition.value = 1;
+        } else if (strcmp(value, "false") == 0) {
+            condition.value = 0;
+        } else {
+            return false;
+        }
+    } else {
+        char *valueEnd;
+        condition.value = strtol(value, &valueEnd, 10);
+        if (valueEnd == value || *valueEnd != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RuleEngine::fillConditionJson(const RuleCondition& condition, JsonObject& json)
+{
+    static const char *const attributes[] = { "presence", "lastupdated", "lightlevel", "dark", "daylight", "on", "bri" };
+    static const char *const operators[] = { "eq", "gt", "lt", "dx", "in", "not in" };
+    char address[40];
+    char value[24];
+    value[0] = '\0';
+    if (condition.attribute == RULE_ATTR_LOCALTIME) {
+        strlcpy(address, "/config/localtime", sizeof(address));
+        uint32_t a = condition.value;
+        uint32_t b = condition.value2;
+        snprintf_P(value, sizeof(value), PSTR("T%02u:%02u:%02u/T%02u:%02u:%02u"),
+                   a / 3600, (a / 60) % 60, a % 60, b / 3600, (b / 60) % 60, b % 60);
+    } else {
+        if (condition.source >= RULE_SOURCE_LIGHT) {
+            snprintf_P(address, sizeof(address), PSTR("/lights/%u/state/%s"),
+                       condition.source - RULE_SOURCE_LIGHT + 1, attributes[condition.attribute]);
+        } else {
+            snprintf_P(address, sizeof(address), PSTR("/sensors/%u/state/%s"),
+                       condition.source == RULE_SOURCE_PRESENCE ? 1 : 2, attributes[condition.attribute]);
+        }
+        if (condition.op != RULE_OP_DX) {
+            if (condition.attribute == RULE_ATTR_LIGHTLEVEL || condition.attribute == RULE_ATTR_BRI) {
+                snprintf_P(value, sizeof(value), PSTR("%ld"), (long)condition.value);
+            } else {
+                strlcpy(value, condition.value ? "true" : "false", sizeof(value));
+            }
+        }
+    }
+    // char* is copied into the buffer
+    json["address"] = address;
+    json["operator"] = operators[condition.op];
+    if (value[0] != '\0') {
+        json["value"] = value;
+    }
+}
+
+int32_t RuleEngine::currentValue(const RuleCondition& condition)
+{
+    switch (condition.attribute) {
+        case RULE_ATTR_PRESENCE:
+            return pSensor->presence;
+        case RULE_ATTR_LIGHTLEVEL:
+            return pSensor->lightlevel;
+        case RULE_ATTR_DARK:
+            return pSensor->dark;
+        case RULE_ATTR_DAYLIGHT:
+            return !pSensor->dark;
+        case RULE_ATTR_ON:
+            return pLights[condition.source - RULE_SOURCE_LIGHT].on;
+        case RULE_ATTR_BRI:
+            return pLights[condition.source - RULE_SOURCE_LIGHT].brightness;
+        case RULE_ATTR_LOCALTIME: {
+            time_t now = time(nullptr);
+            struct tm *tm = localtime(&now);
+            return tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+        }
+        default:
+            return 0;
+    }
+}
+
+bool RuleEngine::test(const RuleCondition& condition, int source)
+{
+    if (condition.op == RULE_OP_DX) {
+        // the events are only sent on changes, so dx is true for the event of its source
+        return condition.source == source;
+    }
+    if (condition.source == RULE_SOURCE_CLOCK && pClockTime == 0) {
+        // no valid time yet
+        return false;
+    }
+    int32_t value = currentValue(condition);
+    switch (condition.op) {
+        case RULE_OP_EQ:
+            return value == condition.value;
+        case RULE_OP_GT:
+            return value > condition.value;
+        case RULE_OP_LT:
+            return value < condition.value;
+        case RULE_OP_IN:
+        case RULE_OP_NOT_IN: {
+            bool in;
+            if (condition.value <= condition.value2) {
+                in = value >= condition.value && value < condition.value2;
+            } else {
+                // the window crosses midnight
+                in = value >= condition.value || value < condition.value2;
+            }
+            return condition.op == RULE_OP_IN ? in : !in;
+        }
+        default:
+            return false;
+    }
+}
+
+// the index is only built on changes of the rules, the events just look up their mask
+void RuleEngine::buildDependencies()
+{
+    for (int s = 0; s < RULE_SOURCES; s++) {
+        pDependencies[s].clearAll();
+    }
+    for (int i = 0; i < MAX_RULES; i++) {
+        const Rule& rule = pRules[i];
+        if ((rule.flags & (RULE_FLAG_USED | RULE_FLAG_ENABLED)) != (RULE_FLAG_USED | RULE_FLAG_ENABLED)) {
+            continue;
+        }
+        for (int c = 0; c < rule.conditionCount; c++) {
+            if (rule.conditions[c].source < RULE_SOURCES) {
+                pDependencies[rule.conditions[c].source].set(i);
+            }
+        }
+    }
+}
+
+// file: 'R' 'U' version record size, followed by MAX_RULES records
+void RuleEngine::save()
+{
+    File file = SPIFFS.open(RULES_FILE, "w");
+    if (!file) {
+        DEBUG_PRINTLN("Failed to create file: " RULES_FILE);
+        return;
+    }
+    uint8_t header[4] = { 'R', 'U', RULES_FILE_VERSION, sizeof(Rule) };
+    file.write(header, sizeof(header));
+    file.write((const uint8_t*)pRules, sizeof(pRules));
+    file.close();
+}
+
+void RuleEngine::load()
+{
+    File file = SPIFFS.open(RULES_FILE, "r");
+    if (!file) {
+        return;
+    }
+    uint8_t header[4];
+    if (file.read(header, sizeof(header)) != sizeof(header) || header[0] != 'R' || header[1] != 'U'
+        || header[2] != RULES_FILE_VERSION || header[3] != sizeof(Rule)
+        || file.read((uint8_t*)pRules, sizeof(pRules)) != sizeof(pRules)) {
+        DEBUG_PRINTLN("Ignore invalid file: " RULES_FILE);
+        memset(pRules, 0, sizeof(pRules));
+    }
+    file.close();
+}
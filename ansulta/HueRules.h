@@ -0,0 +1,127 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Local rules of the Hue API. Supported condition addresses:
+  /sensors/1/state/presence      eq, dx
+  /sensors/1/state/lastupdated   dx
+  /sensors/2/state/lightlevel    eq, gt, lt, dx
+  /sensors/2/state/dark          eq, dx
+  /sensors/2/state/daylight      eq, dx
+  /sensors/2/state/lastupdated   dx
+  /lights/<id>/state/on          eq, dx
+  /lights/<id>/state/bri         eq, gt, lt, dx
+  /config/localtime              in, not in  "Thh:mm:ss/Thh:mm:ss"
+The actions are light state or group action commands.
+Each event source has a precomputed mask of the rules referencing it,
+an event only evaluates these rules. A rule triggers when all its
+conditions become true, a rule with dx on each change of that value
+while the other conditions are true.
+
+**************************************************************/
+#ifndef HUERULES_H
+#define HUERULES_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "HueLightAction.h"
+
+namespace hue {
+
+#define MAX_RULES 16
+#define MAX_RULE_CONDITIONS 4
+#define MAX_RULE_ACTIONS 4
+#define RULE_NAME_SIZE 33
+#define RULES_FILE "/rules.bin"
+#define RULES_FILE_VERSION 1
+
+// event sources, the lights follow as RULE_SOURCE_LIGHT + light number
+#define RULE_SOURCE_PRESENCE   0
+#define RULE_SOURCE_LIGHTLEVEL 1
+#define RULE_SOURCE_CLOCK      2
+#define RULE_SOURCE_LIGHT      3
+#define RULE_SOURCES (RULE_SOURCE_LIGHT + MAX_LIGHT_HANDLERS)
+
+#define RULE_ATTR_PRESENCE    0
+#define RULE_ATTR_LASTUPDATED 1
+#define RULE_ATTR_LIGHTLEVEL  2
+#define RULE_ATTR_DARK        3
+#define RULE_ATTR_DAYLIGHT    4
+#define RULE_ATTR_ON          5
+#define RULE_ATTR_BRI         6
+#define RULE_ATTR_LOCALTIME   7
+
+#define RULE_OP_EQ     0
+#define RULE_OP_GT     1
+#define RULE_OP_LT     2
+#define RULE_OP_DX     3
+#define RULE_OP_IN     4
+#define RULE_OP_NOT_IN 5
+
+#define RULE_FLAG_USED    0x01
+#define RULE_FLAG_ENABLED 0x02
+
+typedef LightBitset<MAX_RULES> RuleMask;
+
+struct RuleCondition {
+  uint8_t source;     // RULE_SOURCE_*
+  uint8_t attribute;  // RULE_ATTR_*
+  uint8_t op;         // RULE_OP_*
+  uint8_t reserved;
+  int32_t value;      // localtime: start second of the day
+  int32_t value2;     // localtime: end second of the day
+} __attribute__((packed));
+
+// persisted as is in RULES_FILE
+struct Rule {
+  char name[RULE_NAME_SIZE];
+  uint8_t flags;  // RULE_FLAG_*
+  uint8_t conditionCount;
+  uint8_t actionCount;
+  uint16_t timesTriggered;
+  uint32_t lastTriggered;
+  RuleCondition conditions[MAX_RULE_CONDITIONS];
+  LightAction actions[MAX_RULE_ACTIONS];
+} __attribute__((packed));
+
+class RuleEngine {
+  public:
+    RuleEngine();
+    // loads the rules, the values of the conditions are read from sensor and lights
+    void begin(const SensorState *sensor, const LightInfo *lights, ActionFunction fn);
+    // evaluates the rules depending on the source, called once per changed source
+    void onEvent(int source);
+    // sends a clock event on each new second if a rule depends on the time
+    void update();
+    // returns the 1-based id, 0 if the table is full or the body invalid (error is set then)
+    int create(JsonObject& body, const char **error);
+    bool change(int id, JsonObject& body, const char **error);
+    bool remove(int id);
+    bool fillJson(int id, JsonObject& root);
+    void fillAllJson(JsonObject& root);
+
+  protected:
+    ActionFunction pAction;
+    const SensorState *pSensor;
+    const LightInfo *pLights;
+    Rule pRules[MAX_RULES];
+    RuleMask pDependencies[RULE_SOURCES];  // rules referencing each source
+    RuleMask pResults;                     // rules with all conditions true at the last evaluation
+    uint32_t pClockTime;
+
+    bool parse(JsonObject& body, Rule& rule, bool create, const char **error);
+    bool parseCondition(JsonObject& json, RuleCondition& condition);
+    void fillConditionJson(const RuleCondition& condition, JsonObject& json);
+    int32_t currentValue(const RuleCondition& condition);
+    bool test(const RuleCondition& condition, int source);
+    void buildDependencies();
+    void save();
+    void load();
+};
+
+};
+#endif
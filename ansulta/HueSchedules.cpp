@@ -0,0 +1,491 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Local schedules of the Hue API executed by a hashed timer wheel.
+
+**************************************************************/
+#include "HueSchedules.h"
+#include <FS.h>
+#include <time.h>
+#include "debug.h"
+
+using namespace hue;
+
+// before NTP the clock counts from 1970
+#define SCHEDULE_MIN_VALID_TIME 1500000000UL
+#define SECONDS_PER_DAY 86400UL
+
+ScheduleStore::ScheduleStore()
+{
+    memset(pSchedules, 0, sizeof(pSchedules));
+    for (int i = 0; i < SCHEDULE_WHEEL_SLOTS; i++) {
+        pWheel[i] = -1;
+    }
+    for (int i = 0; i < MAX_SCHEDULES; i++) {
+        pNext[i] = -1;
+        pPrev[i] = -1;
+        pRounds[i] = 0;
+        pDue[i] = 0;
+    }
+    pWheelTime = 0;
+    pClockValid = false;
+}
+
+void ScheduleStore::begin(ActionFunction fn)
+{
+    pAction = fn;
+    load();
+    clockChanged();
+}
+
+void ScheduleStore::clockChanged()
+{
+    uint32_t now = time(nullptr);
+    if (pClockValid && now > pWheelTime) {
+        // the loop stalled or the clock stepped forward
+        fireSkipped(now);
+    }
+    pClockValid = now > SCHEDULE_MIN_VALID_TIME;
+    for (int i = 0; i < MAX_SCHEDULES; i++) {
+        disarm(i);
+    }
+    if (!pClockValid) {
+        return;
+    }
+    pWheelTime = now;
+    for (int i = 0; i < MAX_SCHEDULES; i++) {
+        if ((pSchedules[i].flags & (SCHEDULE_FLAG_USED | SCHEDULE_FLAG_ENABLED)) == (SCHEDULE_FLAG_USED | SCHEDULE_FLAG_ENABLED)) {
+            arm(i, now);
+        }
+    }
+}
+
+void ScheduleStore::update()
+{
+    if (!pClockValid) {
+        return;
+    }
+    uint32_t now = time(nullptr);
+    if (now < pWheelTime || now - pWheelTime > SCHEDULE_WHEEL_SLOTS) {
+        // the clock was adjusted or the loop stalled, compute all due times again
+        clockChanged();
+        return;
+    }
+    while (pWheelTime != now) {
+        pWheelTime++;
+        int16_t index = pWheel[pWheelTime % SCHEDULE_WHEEL_SLOTS];
+        while (index >= 0) {
+            // fire() may add the schedule again at the head of this slot
+            int16_t next = pNext[index];
+            if (pRounds[index] == 0) {
+                disarm(index);
+                fire(index);
+            } else {
+                pRounds[index]--;
+            }
+            index = next;
+        }
+    }
+}
+
+int ScheduleStore::create(JsonObject& body, const char **error)
+{
+    *error = NULL;
+    int index = -1;
+    for (int i = 0; i < MAX_SCHEDULES; i++) {
+        if (!(pSchedules[i].flags & SCHEDULE_FLAG_USED)) {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1) {
+        return 0;
+    }
+    if (!parse(body, pSchedules[index], true, error)) {
+        memset(&pSchedules[index], 0, sizeof(Schedule));
+        return 0;
+    }
+    if (pClockValid && (pSchedules[index].flags & SCHEDULE_FLAG_ENABLED)) {
+        arm(index, time(nullptr));
+    }
+    save();
+    return index + 1;
+}
+
+bool ScheduleStore::change(int id, JsonObject& body, const char **error)
+{
+    *error = NULL;
+    int index = id - 1;
+    if (index < 0 || index >= MAX_SCHEDULES || !(pSchedules[index].flags & SCHEDULE_FLAG_USED)) {
+        return false;
+    }
+    Schedule schedule = pSchedules[index];
+    if (!parse(body, schedule, false, error)) {
+        return false;
+    }
+    if (body.containsKey("localtime") || body.containsKey("status")) {
+        // a changed or enabled timer starts again
+        schedule.start = 0;
+    }
+    disarm(index);
+    pSchedules[index] = schedule;
+    if (pClockValid && (schedule.flags & SCHEDULE_FLAG_ENABLED)) {
+        arm(index, time(nullptr));
+    }
+    save();
+    return true;
+}
+
+bool ScheduleStore::remove(int id)
+{
+    int index = id - 1;
+    if (index < 0 || index >= MAX_SCHEDULES || !(pSchedules[index].flags & SCHEDULE_FLAG_USED)) {
+        return false;
+    }
+    disarm(index);
+    memset(&pSchedules[index], 0, sizeof(Schedule));
+    save();
+    return true;
+}
+
+bool ScheduleStore::fillJson(int id, JsonObject& root)
+{
+    int index = id - 1;
+    if (index < 0 || index >= MAX_SCHEDULES || !(pSchedules[index].flags & SCHEDULE_FLAG_USED)) {
+        return false;
+    }
+    const Schedule& schedule = pSchedules[index];
+    char localtime[24];
+    formatLocaltime(schedule, localtime, sizeof(localtime));
+    root["name"] = schedule.name;
+    root["description"] = "";
+    fillLightActionJson(schedule.action, root.createNestedObject("command"));
+    // char* is copied into the buffer
+    root["localtime"] = localtime;
+    root["time"] = localtime;
+    root["status"] = (schedule.flags & SCHEDULE_FLAG_ENABLED) ? "enabled" : "disabled";
+    root["autodelete"] = (schedule.flags & SCHEDULE_FLAG_AUTODELETE) != 0;
+    if (schedule.kind == SCHEDULE_TIMER && schedule.start != 0) {
+        char starttime[24];
+        time_t start = schedule.start;
+        strftime(starttime, sizeof(starttime), "%Y-%m-%dT%H:%M:%S", gmtime(&start));
+        root["starttime"] = starttime;
+    }
+    return true;
+}
+
+void ScheduleStore::fillAllJson(JsonObject& root)
+{
+    for (int i = 0; i < MAX_SCHEDULES; i++) {
+        if (pSchedules[i].flags & SCHEDULE_FLAG_USED) {
+            fillJson(i + 1, root.createNestedObject(String(i + 1)));
+        }
+    }
+}
+
+bool ScheduleStore::parse(JsonObject& body, Schedule& schedule, bool create, const char **error)
+{
+    if (create) {
+        memset(&schedule, 0, sizeof(Schedule));
+        schedule.flags = SCHEDULE_FLAG_USED | SCHEDULE_FLAG_ENABLED;
+        strlcpy(schedule.name, "schedule", sizeof(schedule.name));
+    }
+    const char *name = body["name"];
+    if (name) {
+        strlcpy(schedule.name, name, sizeof(schedule.name));
+    }
+    if (body.containsKey("command")) {
+        if (!parseLightAction(body["command"], schedule.action)) {
+            *error = "invalid value for parameter, command";
+            return false;
+        }
+    } else if (create) {
+        *error = "missing parameters in body, command";
+        return false;
+    }
+    const char *localtime = body["localtime"];
+    if (localtime) {
+        if (!parseLocaltime(localtime, schedule)) {
+            *error = "invalid value for parameter, localtime";
+            return false;
+        }
+    } else if (create) {
+        *error = "missing parameters in body, localtime";
+        return false;
+    }
+    bool autodelete = create ? schedule.kind != SCHEDULE_RECURRING : (schedule.flags & SCHEDULE_FLAG_AUTODELETE) != 0;
+    if (body.containsKey("autodelete")) {
+        autodelete = body["autodelete"].as<bool>();
+    }
+    if (autodelete) {
+        schedule.flags |= SCHEDULE_FLAG_AUTODELETE;
+    } else {
+        schedule.flags &= ~SCHEDULE_FLAG_AUTODELETE;
+    }
+    const char *status = body["status"];
+    if (status) {
+        if (strcmp(status, "enabled") == 0) {
+            schedule.flags |= SCHEDULE_FLAG_ENABLED;
+        } else if (strcmp(status, "disabled") == 0) {
+            schedule.flags &= ~SCHEDULE_FLAG_ENABLED;
+        } else {
+            *error = "invalid value for parameter, status";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ScheduleStore::parseLocaltime(const char *localtime, Schedule& schedule)
+{
+    unsigned int a, b, c, d, e, f;
+    int end = 0;
+    if (sscanf(localtime, "W%u/T%u:%u:%u%n", &a, &b, &c, &d, &end) == 4 && localtime[end] == '\0') {
+        if (a == 0 || a > 127 || b > 23 || c > 59 || d > 59) {
+            return false;
+        }
+        schedule.kind = SCHEDULE_RECURRING;
+        schedule.weekdays = a;
+        schedule.time = b * 3600 + c * 60 + d;
+        return true;
+    }
+    const char *timer = localtime;
+    unsigned int repeat = 1;
+    if (localtime[0] == 'R') {
+        // "R/PT.." runs forever, "Rnn/PT.." nn times
+        timer = strchr(localtime, '/');
+        if (timer == NULL) {
+            return false;
+        }
+        timer++;
+        repeat = atoi(localtime + 1);
+        if (repeat > 99) {
+            return false;
+        }
+    }
+    if (sscanf(timer, "PT%u:%u:%u%n", &a, &b, &c, &end) == 3 && timer[end] == '\0') {
+        if (a > 99 || b > 59 || c > 59 || (a == 0 && b == 0 && c == 0)) {
+            return false;
+        }
+        schedule.kind = SCHEDULE_TIMER;
+        schedule.repeat = repeat;
+        schedule.time = a * 3600 + b * 60 + c;
+        schedule.start = 0;
+        return true;
+    }
+    if (sscanf(localtime, "%u-%u-%uT%u:%u:%u%n", &a, &b, &c, &d, &e, &f, &end) == 6 && localtime[end] == '\0') {
+        if (a < 2000 || b < 1 || b > 12 || c < 1 || c > 31 || d > 23 || e > 59 || f > 59) {
+            return false;
+        }
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = a - 1900;
+        tm.tm_mon = b - 1;
+        tm.tm_mday = c;
+        tm.tm_hour = d;
+        tm.tm_min = e;
+        tm.tm_sec = f;
+        tm.tm_isdst = -1;
+        schedule.kind = SCHEDULE_ABSOLUTE;
+        schedule.time = mktime(&tm);
+        return true;
+    }
+    return false;
+}
+
+void ScheduleStore::formatLocaltime(const Schedule& schedule, char *buffer, size_t size)
+{
+    uint32_t t = schedule.time;
+    switch (schedule.kind) {
+        case SCHEDULE_RECURRING:
+            snprintf_P(buffer, size, PSTR("W%03u/T%02u:%02u:%02u"), schedule.weekdays, t / 3600, (t / 60) % 60, t % 60);
+            break;
+        case SCHEDULE_TIMER:
+            if (schedule.repeat == 1) {
+                snprintf_P(buffer, size, PSTR("PT%02u:%02u:%02u"), t / 3600, (t / 60) % 60, t % 60);
+            } else if (schedule.repeat == 0) {
+                snprintf_P(buffer, size, PSTR("R/PT%02u:%02u:%02u"), t / 3600, (t / 60) % 60, t % 60);
+            } else {
+                snprintf_P(buffer, size, PSTR("R%02u/PT%02u:%02u:%02u"), schedule.repeat, t / 3600, (t / 60) % 60, t % 60);
+            }
+            break;
+        default: {
+            time_t absolute = t;
+            strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", localtime(&absolute));
+            break;
+        }
+    }
+}
+
+// next time the schedule is due after now, 0 if it is expired
+uint32_t ScheduleStore::nextDue(int index, uint32_t now)
+{
+    Schedule& schedule = pSchedules[index];
+    switch (schedule.kind) {
+        case SCHEDULE_RECURRING: {
+            time_t t = now;
+            struct tm *tm = localtime(&t);
+            uint32_t dayStart = now - (tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec);
+            int weekday = tm->tm_wday;
+            for (int day = 0; day <= 7; day++) {
+                uint32_t due = dayStart + day * SECONDS_PER_DAY + schedule.time;
+                // tm_wday counts from Sunday, the Hue mask has Sunday in bit 0 and Monday in bit 6
+                int wday = (weekday + day) % 7;
+                uint8_t bit = wday == 0 ? 1 : 1 << (7 - wday);
+                if ((schedule.weekdays & bit) && due > now) {
+                    return due;
+                }
+            }
+            return 0;
+        }
+        case SCHEDULE_TIMER:
+            if (schedule.start == 0) {
+                schedule.start = now;
+            }
+            // a timer that ran out while the bridge was off fires now
+            return schedule.start + schedule.time;
+        default:
+            return schedule.time > now ? schedule.time : 0;
+    }
+}
+
+void ScheduleStore::arm(int index, uint32_t now)
+{
+    uint32_t due = nextDue(index, now);
+    if (due == 0) {
+        finish(index);
+        return;
+    }
+    if (due <= pWheelTime) {
+        due = pWheelTime + 1;
+    }
+    int slot = due % SCHEDULE_WHEEL_SLOTS;
+    pDue[index] = due;
+    // the slot is visited every SCHEDULE_WHEEL_SLOTS seconds before it is due
+    pRounds[index] = (due - pWheelTime - 1) / SCHEDULE_WHEEL_SLOTS;
+    pPrev[index] = -1;
+    pNext[index] = pWheel[slot];
+    if (pWheel[slot] >= 0) {
+        pPrev[pWheel[slot]] = index;
+    }
+    pWheel[slot] = index;
+}
+
+// fires each schedule due up to now once in the order of the due times, so an
+// absolute schedule does not expire unfired and a recurring one does not skip
+// its run, clockChanged() arms them again afterwards
+void ScheduleStore::fireSkipped(uint32_t now)
+{
+    bool fired[MAX_SCHEDULES] = {};
+    while (true) {
+        int first = -1;
+        for (int i = 0; i < MAX_SCHEDULES; i++) {
+            if (!fired[i] && pDue[i] != 0 && pDue[i] <= now && (first < 0 || pDue[i] < pDue[first])) {
+                first = i;
+            }
+        }
+        if (first < 0) {
+            return;
+        }
+        fired[first] = true;
+        pWheelTime = pDue[first];
+        disarm(first);
+        fire(first);
+    }
+}
+
+void ScheduleStore::disarm(int index)
+{
+    if (pDue[index] == 0) {
+        return;
+    }
+    int slot = pDue[index] % SCHEDULE_WHEEL_SLOTS;
+    if (pPrev[index] >= 0) {
+        pNext[pPrev[index]] = pNext[index];
+    } else {
+        pWheel[slot] = pNext[index];
+    }
+    if (pNext[index] >= 0) {
+        pPrev[pNext[index]] = pPrev[index];
+    }
+    pNext[index] = -1;
+    pPrev[index] = -1;
+    pDue[index] = 0;
+}
+
+void ScheduleStore::fire(int index)
+{
+    Schedule& schedule = pSchedules[index];
+    DEBUG_PRINT("schedule due: ");
+    DEBUG_PRINTLN(schedule.name);
+    if (pAction) {
+        pAction(schedule.action);
+    }
+    switch (schedule.kind) {
+        case SCHEDULE_RECURRING:
+            arm(index, pWheelTime);
+            break;
+        case SCHEDULE_TIMER:
+            if (schedule.repeat == 1) {
+                finish(index);
+                break;
+            }
+            schedule.start = pWheelTime;
+            if (schedule.repeat > 1) {
+                // only the counted timers are stored, the others would write the flash on each run
+                schedule.repeat--;
+                save();
+            }
+            arm(index, pWheelTime);
+            break;
+        default:
+            finish(index);
+            break;
+    }
+}
+
+// the schedule will not run again
+void ScheduleStore::finish(int index)
+{
+    if (pSchedules[index].flags & SCHEDULE_FLAG_AUTODELETE) {
+        memset(&pSchedules[index], 0, sizeof(Schedule));
+    } else {
+        pSchedules[index].flags &= ~SCHEDULE_FLAG_ENABLED;
+    }
+    save();
+}
+
+// file: 'S' 'C' version record size, followed by MAX_SCHEDULES records
+void ScheduleStore::save()
+{
+    File file = SPIFFS.open(SCHEDULES_FILE, "w");
+    if (!file) {
+        DEBUG_PRINTLN("Failed to create file: " SCHEDULES_FILE);
+        return;
+    }
+    uint8_t header[4] = { 'S', 'C', SCHEDULES_FILE_VERSION, sizeof(Schedule) };
+    file.write(header, sizeof(header));
+    file.write((const uint8_t*)pSchedules, sizeof(pSchedules));
+    file.close();
+}
+
+void ScheduleStore::load()
+{
+    File file = SPIFFS.open(SCHEDULES_FILE, "r");
+    if (!file) {
+        return;
+    }
+    uint8_t header[4];
+    if (file.read(header, sizeof(header)) != sizeof(header) || header[0] != 'S' || header[1] != 'C'
+        || header[2] != SCHEDULES_FILE_VERSION || header[3] != sizeof(Schedule)
+        || file.read((uint8_t*)pSchedules, sizeof(pSchedules)) != sizeof(pSchedules)) {
+        DEBUG_PRINTLN("Ignore invalid file: " SCHEDULES_FILE);
+        memset(pSchedules, 0, sizeof(pSchedules));
+    }
+    file.close();
+}
@@ -0,0 +1,96 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Local schedules of the Hue API, the supported "localtime" formats:
+  YYYY-MM-DDThh:mm:ss     absolute time
+  W<bbb>/Thh:mm:ss        recurring, bbb is the weekday mask (Monday 64 .. Sunday 1)
+  PThh:mm:ss              timer
+  R[nn]/PThh:mm:ss        recurring timer, nn times or forever
+The due schedules are found by a hashed timer wheel with one slot
+per second, each tick only visits the schedules of its slot.
+
+**************************************************************/
+#ifndef HUESCHEDULES_H
+#define HUESCHEDULES_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "HueLightAction.h"
+
+namespace hue {
+
+#define MAX_SCHEDULES 16
+#define SCHEDULE_NAME_SIZE 33
+#define SCHEDULE_WHEEL_SLOTS 64
+#define SCHEDULES_FILE "/schedules.bin"
+#define SCHEDULES_FILE_VERSION 1
+
+#define SCHEDULE_ABSOLUTE  0
+#define SCHEDULE_RECURRING 1
+#define SCHEDULE_TIMER     2
+
+#define SCHEDULE_FLAG_USED       0x01
+#define SCHEDULE_FLAG_ENABLED    0x02
+#define SCHEDULE_FLAG_AUTODELETE 0x04
+
+// persisted as is in SCHEDULES_FILE
+struct Schedule {
+  char name[SCHEDULE_NAME_SIZE];
+  uint8_t kind;      // SCHEDULE_*
+  uint8_t flags;     // SCHEDULE_FLAG_*
+  uint8_t weekdays;  // recurring: bit mask, Monday 64 .. Sunday 1
+  uint8_t repeat;    // timer: remaining runs, 0 runs forever
+  uint32_t time;     // absolute: local time in seconds, recurring: second of the day, timer: duration
+  uint32_t start;    // timer: when the timer was started
+  LightAction action;
+} __attribute__((packed));
+
+class ScheduleStore {
+  public:
+    ScheduleStore();
+    // loads the schedules, the actions are passed to fn
+    void begin(ActionFunction fn);
+    // the clock was set or jumped, all schedules are armed again, the ones
+    // due in a skipped time fire once before
+    void clockChanged();
+    // advances the wheel to the current time, called from the loop
+    void update();
+    // returns the 1-based id, 0 if the table is full or the body invalid (error is set then)
+    int create(JsonObject& body, const char **error);
+    bool change(int id, JsonObject& body, const char **error);
+    bool remove(int id);
+    bool fillJson(int id, JsonObject& root);
+    void fillAllJson(JsonObject& root);
+
+  protected:
+    ActionFunction pAction;
+    Schedule pSchedules[MAX_SCHEDULES];
+    // timer wheel, the lists are linked by the schedule index
+    int16_t pWheel[SCHEDULE_WHEEL_SLOTS];
+    int16_t pNext[MAX_SCHEDULES];
+    int16_t pPrev[MAX_SCHEDULES];
+    uint32_t pRounds[MAX_SCHEDULES];  // visits of the slot before the schedule is due
+    uint32_t pDue[MAX_SCHEDULES];     // 0 if not armed
+    uint32_t pWheelTime;              // last processed second
+    bool pClockValid;
+
+    bool parse(JsonObject& body, Schedule& schedule, bool create, const char **error);
+    bool parseLocaltime(const char *localtime, Schedule& schedule);
+    void formatLocaltime(const Schedule& schedule, char *buffer, size_t size);
+    uint32_t nextDue(int index, uint32_t now);
+    void arm(int index, uint32_t now);
+    void fireSkipped(uint32_t now);
+    void disarm(int index);
+    void fire(int index);
+    void finish(int index);
+    void save();
+    void load();
+};
+
+};
+#endif
@@ -17,49 +17,27 @@ https://github.com/probonopd/ESP8266HueEmulator
 
 namespace hue {
   
-// Group and Scene file name prefixes for SPIFFS support 
-String GROUP_FILE_TEMPLATE = "GROUP-%d.json";
-String SCENE_FILE_TEMPLATE = "SCENE-%d.json";
+// Group and Scene file name prefixes for SPIFFS support, format with slotFileName()
+static const char GROUP_FILE_TEMPLATE[] PROGMEM = "GROUP-%d.json";
+static const char SCENE_FILE_TEMPLATE[] PROGMEM = "SCENE-%d.json";
 
-
-static const char* SSDP_RESPONSE_TEMPLATE =
-  "HTTP/1.1 200 OK\r\n"
-  "EXT:\r\n"
-  "CACHE-CONTROL: max-age=%u\r\n" // SSDP_INTERVAL
-  "LOCATION: http://%s:%u/%s\r\n" // WiFi.localIP(), _port, _schemaURL
-  "SERVER: FreeRTOS/6.0.5, UPnP/1.0, %s/%s\r\n" // _modelName, _modelNumber
-  "hue-bridgeid: %s\r\n"
-  "ST: %s\r\n"  // _deviceType
-  "USN: uuid:%s::upnp:rootdevice\r\n" // _uuid::_deviceType
-  "\r\n";
-
-static const char* SSDP_NOTIFY_TEMPLATE =
-  "NOTIFY * HTTP/1.1\r\n"
-  "HOST: 239.255.255.250:1900\r\n"
-  "NTS: ssdp:alive\r\n"
-  "CACHE-CONTROL: max-age=%u\r\n" // SSDP_INTERVAL
-  "LOCATION: http://%s:%u/%s\r\n" // WiFi.localIP(), _port, _schemaURL
-  "SERVER: FreeRTOS/6.0.5, UPnP/1.0, %s/%s\r\n" // _modelName, _modelNumber
-  "hue-bridgeid: %s\r\n"
-  "NT: %s\r\n"  // _deviceType
-  "USN: uuid:%s::upnp:rootdevice\r\n" // _uuid
-  "\r\n";
-  
-static const char* SSDP_XML_TEMPLATE = "<?xml version=\"1.0\" ?>"
+// the templates are read directly from flash with snprintf_P()
+// arguments: ip, port, ip, mac, mac
+static const char SSDP_XML_TEMPLATE[] PROGMEM = "<?xml version=\"1.0\" ?>"
   "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
   "<specVersion><major>1</major><minor>0</minor></specVersion>"
-  "<URLBase>http://{ip}:{port}/</URLBase>"
+  "<URLBase>http://%s:%u/</URLBase>"
   "<device>"
     "<deviceType>urn:schemas-upnp-org:device:Basic:1</deviceType>"
-    "<friendlyName>Philips hue ({ip})</friendlyName>"
+    "<friendlyName>Philips hue (%s)</friendlyName>"
     "<manufacturer>Royal Philips Electronics</manufacturer>"
     "<manufacturerURL>https://github.com/atiderko/esp8266-ansulta-alexa</manufacturerURL>"
     "<modelDescription>Ansulta Remote Bridge</modelDescription>"
     "<modelName>Philips hue bridge 2012</modelName>"
     "<modelNumber>929000226503</modelNumber>"
     "<modelURL>http://www.meethue.com</modelURL>"
-    "<serialNumber>{mac}</serialNumber>"
-    "<UDN>uuid:2f402f80-da50-11e1-9b23-{mac}</UDN>"
+    "<serialNumber>%s</serialNumber>"
+    "<UDN>uuid:2f402f80-da50-11e1-9b23-%s</UDN>"
     "<presentationURL>index.html</presentationURL>"
     "<iconList>"
     "  <icon>"
@@ -79,5 +57,18 @@ static const char* SSDP_XML_TEMPLATE = "<?xml version=\"1.0\" ?>"
     "</iconList>"
   "</device>"
   "</root>";
+
+// arguments: ip, lights, group files, scene files
+static const char INDEX_PAGE_TEMPLATE[] PROGMEM = "<html><body>"
+  "<h2>Philips HUE ( %s )</h2>"
+  "<p>Available lights:</p>"
+  "<ul>%s</ul>"
+  "<ul>File Cache</ul>"
+  "<ul>Groups:</ul>"
+  "<ul>%s</ul>"
+  "<ul>Scenes:</ul>"
+  "<ul>%s</ul>"
+  "<a href='/cache/clear'>Clear Cached Groups and Scenes</a>"
+  "</body></html>";
 };
 #endif
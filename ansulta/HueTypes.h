@@ -16,10 +16,113 @@ https://github.com/probonopd/ESP8266HueEmulator
 #define HUETYPES_H
 
 #include <ArduinoJson.h>
+#include <time.h>
 #include "debug.h"
 
 namespace hue {
 
+// capacity of the emulated bridge, can be set by the build, e.g. 64 like a real Hue bridge
+#ifndef MAX_LIGHT_HANDLERS
+#define MAX_LIGHT_HANDLERS 16
+#endif
+#ifndef MAX_LIGHT_GROUPS
+#define MAX_LIGHT_GROUPS 16
+#endif
+// target states of all scenes together, a scene uses one per member light
+#ifndef MAX_SCENE_LIGHT_STATES
+#define MAX_SCENE_LIGHT_STATES (4 * MAX_LIGHT_GROUPS)
+#endif
+
+// Fixed size set of light numbers (0-based). The set bits are visited with
+// count trailing zeros, so the cost is proportional to the number of members:
+//   for (int i = mask.first(); i >= 0; i = mask.next(i)) { ... }
+template<int N>
+class LightBitset {
+  public:
+    LightBitset() {
+      clearAll();
+    }
+    void set(int index) {
+      if (index >= 0 && index < N) {
+        pWords[index >> 5] |= (1u << (index & 31));
+      }
+    }
+    void clear(int index) {
+      if (index >= 0 && index < N) {
+        pWords[index >> 5] &= ~(1u << (index & 31));
+      }
+    }
+    bool test(int index) const {
+      return index >= 0 && index < N && (pWords[index >> 5] & (1u << (index & 31)));
+    }
+    // set bits below index, the position of a member in the first()/next() order
+    int rank(int index) const {
+      int result = 0;
+      int w = index >> 5;
+      for (int i = 0; i < w; i++) {
+        result += __builtin_popcount(pWords[i]);
+      }
+      if (index & 31) {
+        result += __builtin_popcount(pWords[w] & ((1u << (index & 31)) - 1));
+      }
+      return result;
+    }
+    void setAll() {
+      for (int w = 0; w < WORDS; w++) {
+        pWords[w] = 0xFFFFFFFF;
+      }
+      // keep the bits above N cleared
+      if (N & 31) {
+        pWords[WORDS - 1] = (1u << (N & 31)) - 1;
+      }
+    }
+    void clearAll() {
+      for (int w = 0; w < WORDS; w++) {
+        pWords[w] = 0;
+      }
+    }
+    bool any() const {
+      for (int w = 0; w < WORDS; w++) {
+        if (pWords[w]) return true;
+      }
+      return false;
+    }
+    int count() const {
+      int result = 0;
+      for (int w = 0; w < WORDS; w++) {
+        result += __builtin_popcount(pWords[w]);
+      }
+      return result;
+    }
+    // first set bit or -1
+    int first() const {
+      return next(-1);
+    }
+    // next set bit after index or -1
+    int next(int index) const {
+      index++;
+      if (index >= N) {
+        return -1;
+      }
+      int w = index >> 5;
+      uint32_t bits = pWords[w] & (0xFFFFFFFF << (index & 31));
+      while (!bits) {
+        if (++w >= WORDS) {
+          return -1;
+        }
+        bits = pWords[w];
+      }
+      return (w << 5) + __builtin_ctz(bits);
+    }
+
+  protected:
+    static const int WORDS = (N + 31) / 32;
+    uint32_t pWords[WORDS];
+};
+
+typedef LightBitset<MAX_LIGHT_HANDLERS> LightMask;
+typedef LightBitset<MAX_LIGHT_GROUPS> GroupMask;
+
 struct rgbcolor {
   rgbcolor(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b) {};
   uint8_t r;
@@ -28,33 +131,35 @@ struct rgbcolor {
 };
 
 #define COLOR_SATURATION 255.0f
-#define MIN(a,b) ((a<b)?a:b)
-#define MAX(a,b) ((a>b)?a:b)
+// Hue API units: hue 0..65535 (~deg*182.04), saturation 0..255
+#define HUE_SECTOR_X10 109224u  // one of the six color sectors in Hue units (10922.4) times ten
 struct hsvcolor {
+  // fixed point conversion, no floats and no divisions by 255
   hsvcolor(const rgbcolor& color) {
-    float r = ((float)color.r)/COLOR_SATURATION;
-    float g = ((float)color.g)/COLOR_SATURATION;
-    float b = ((float)color.b)/COLOR_SATURATION;
-    float mi = MIN(MIN(r,g),b);
-    float ma = MAX(MAX(r,g),b);
-    float diff = ma - mi;
+    uint8_t ma = color.r > color.g ? color.r : color.g;
+    if (color.b > ma) ma = color.b;
+    uint8_t mi = color.r < color.g ? color.r : color.g;
+    if (color.b < mi) mi = color.b;
+    uint32_t diff = ma - mi;
     v = ma;
+    s = ma ? (diff * 255) / ma : 0;
     h = 0;
-    s = (!v)?0:(diff/ma);
     if (diff) {
-      if (r == v) {
-            h = (g - b) / diff + (g < b ? 6.0f : 0.0f);
-        } else if (g == v) {
-            h = (b - r) / diff + 2.0f;
-        } else {
-            h = (r - g) / diff + 4.0f;
-        }
-        h /= 6.0f;
+      // position inside the six color sectors, scaled by diff
+      int32_t pos;
+      if (color.r == ma) {
+        pos = (int32_t)color.g - color.b + (color.g < color.b ? 6 * (int32_t)diff : 0);
+      } else if (color.g == ma) {
+        pos = (int32_t)color.b - color.r + 2 * (int32_t)diff;
+      } else {
+        pos = (int32_t)color.r - color.g + 4 * (int32_t)diff;
+      }
+      h = ((uint32_t)pos * HUE_SECTOR_X10) / (10 * diff);
     }
   };
-  float h;
-  float s;
-  float v;
+  uint16_t h;  // hue in Hue API units
+  uint8_t s;   // saturation 0..255
+  uint8_t v;   // value 0..255
 };
 
 
@@ -78,16 +183,80 @@ enum class BulbType {
 };
 
 
+// bits of the mask returned by LightInfo::diff()
+#define LIGHT_CHANGED_ON     0x01
+#define LIGHT_CHANGED_BRI    0x02
+#define LIGHT_CHANGED_COLOR  0x04  // hue, saturation or color type
+#define LIGHT_CHANGED_ALERT  0x08
+#define LIGHT_CHANGED_EFFECT 0x10
+#define LIGHT_CHANGED_BULB   0x20
+
+// Packed into 8 bytes, the values use the ranges of the Hue API.
+// The enums are stored in bit fields and accessed by getter/setter.
 struct LightInfo {
-  bool on = false;
-  int brightness = 1;
-  ColorType type = TYPE_CT;
-  BulbType bulbType = BulbType::DIMMABLE_LIGHT;
-  int hue = 0;
-  int saturation = 0;
-  Alert alert = ALERT_NONE;
-  Effect effect = EFFECT_NONE;
-  unsigned int transitionTime = 400; // by default there is a transition time to the new state of 400 milliseconds
+  LightInfo()
+    : hue(0), transitionTime(4), brightness(1), saturation(0), on(false),
+      pType(TYPE_CT), pBulbType((uint8_t)BulbType::DIMMABLE_LIGHT), pAlert(ALERT_NONE), pEffect(EFFECT_NONE) {}
+
+  uint16_t hue;             // 0..65535
+  uint16_t transitionTime;  // multiple of 100 ms, by default there is a transition time to the new state of 400 milliseconds
+  uint8_t brightness;       // 0..254 (NB 0 is not off!)
+  uint8_t saturation;       // 0..254
+  bool on : 1;
+
+  ColorType getType() const { return (ColorType)pType; }
+  void setType(ColorType type) { pType = type; }
+  BulbType getBulbType() const { return (BulbType)pBulbType; }
+  void setBulbType(BulbType bulbType) { pBulbType = (uint8_t)bulbType; }
+  Alert getAlert() const { return (Alert)pAlert; }
+  void setAlert(Alert alert) { pAlert = alert; }
+  Effect getEffect() const { return (Effect)pEffect; }
+  void setEffect(Effect effect) { pEffect = effect; }
+
+  // returns LIGHT_CHANGED_* bits of the fields which differ, the transition time is not a state
+  uint8_t diff(const LightInfo& other) const {
+    uint8_t mask = 0;
+    if (on != other.on) mask |= LIGHT_CHANGED_ON;
+    if (brightness != other.brightness) mask |= LIGHT_CHANGED_BRI;
+    if (hue != other.hue || saturation != other.saturation || pType != other.pType) mask |= LIGHT_CHANGED_COLOR;
+    if (pAlert != other.pAlert) mask |= LIGHT_CHANGED_ALERT;
+    if (pEffect != other.pEffect) mask |= LIGHT_CHANGED_EFFECT;
+    if (pBulbType != other.pBulbType) mask |= LIGHT_CHANGED_BULB;
+    return mask;
+  }
+
+  protected:
+    uint8_t pType : 2;
+    uint8_t pBulbType : 1;
+    uint8_t pAlert : 2;
+    uint8_t pEffect : 1;
+};
+
+static_assert(sizeof(LightInfo) == 8, "LightInfo should stay packed");
+
+
+// Snapshot of the motion and light level sensor, exposed as ZLLPresence and ZLLLightLevel.
+struct SensorState {
+  SensorState()
+    : presence(false), dark(false), suppressed(false), lightlevel(0), tholddark(0),
+      suppressedSeconds(0), presenceUpdated(0), lightlevelUpdated(0) {}
+
+  bool presence;
+  bool dark;
+  bool suppressed;             // the sensor is switched off for suppressedSeconds
+  uint16_t lightlevel;         // 0..65535 like the Hue API, but not calibrated to lux
+  uint16_t tholddark;
+  uint32_t suppressedSeconds;
+  time_t presenceUpdated;
+  time_t lightlevelUpdated;
+};
+
+
+#define SEARCH_TIMEOUT_MS 40000  // a search for new lights ends after this time, like on the Hue bridge
+
+// progress of the search for new lights of a handler
+enum SearchState {
+  SEARCH_IDLE, SEARCH_ACTIVE, SEARCH_FOUND
 };
 
 
@@ -102,6 +271,12 @@ class LightHandler {
     virtual String getFriendlyName(int lightNumber) const {
       return "Hue Light " + ((String) (lightNumber + 1));
     }
+    // search for new lights (POST /lights), must not block the loop
+    virtual void startSearch(int lightNumber) {}
+    virtual void stopSearch(int lightNumber) {}
+    virtual SearchState getSearchState(int lightNumber) {
+      return SEARCH_IDLE;
+    }
 };
 
 
@@ -110,6 +285,11 @@ class LightServiceInterface {
     virtual LightHandler* getLightHandler(int numberOfTheLight) {
         return new LightHandler();
     }
+    // last state reported by the handler of the light
+    virtual const LightInfo& getLightState(int numberOfTheLight) {
+        static LightInfo info;
+        return info;
+    }
 };
 
 };
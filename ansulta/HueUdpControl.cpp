@@ -0,0 +1,153 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Compact binary UDP protocol to switch the lights without HTTP
+and JSON, see HueUdpControl.h for the packet layout.
+
+**************************************************************/
+#include "HueUdpControl.h"
+#include "HueLightService.h"
+#include "metrics.h"
+#include "debug.h"
+
+using namespace hue;
+
+// a sender that was quiet for this time may restart its sequence
+#define UDP_PEER_TIMEOUT_MS 60000
+
+UdpControlClass::UdpControlClass()
+{
+  pLightService = nullptr;
+  pToken = 0;
+  pStarted = false;
+  memset(pPeers, 0, sizeof(pPeers));
+}
+
+void UdpControlClass::begin(LightServiceClass *lightService, uint16_t port)
+{
+  pLightService = lightService;
+  pStarted = pUdp.begin(port) == 1;
+  DEBUG_PRINT("UDP control on port ");
+  DEBUG_PRINTLN(port);
+}
+
+void UdpControlClass::setToken(uint32_t token)
+{
+  pToken = token;
+}
+
+void UdpControlClass::update()
+{
+  if (!pStarted) {
+    return;
+  }
+  int size;
+  while ((size = pUdp.parsePacket()) > 0) {
+    UdpControlPacket cmd;
+    if (size != sizeof(cmd) || pUdp.read((uint8_t*)&cmd, sizeof(cmd)) != sizeof(cmd)
+        || cmd.magic[0] != 'A' || cmd.magic[1] != 'U' || cmd.version != UDP_CONTROL_VERSION) {
+      // not our protocol, do not answer
+      METRIC_INC(udp_rejected);
+      pUdp.flush();
+      continue;
+    }
+    METRIC_INC(udp_commands);
+    if (pToken != 0 && cmd.token != pToken) {
+      METRIC_INC(udp_rejected);
+      sendStatus(cmd, UDP_STATUS_DENIED);
+      continue;
+    }
+    Peer *peer = findPeer(pUdp.remoteIP(), pUdp.remotePort());
+    sendStatus(cmd, handleCommand(cmd, peer));
+  }
+}
+
+// returns the entry of the sender, the least recently seen entry is replaced by a new sender
+UdpControlClass::Peer *UdpControlClass::findPeer(uint32_t ip, uint16_t port)
+{
+  Peer *oldest = &pPeers[0];
+  for (int i = 0; i < UDP_CONTROL_PEERS; i++) {
+    if (pPeers[i].ip == ip && pPeers[i].port == port) {
+      if (millis() - pPeers[i].lastSeenMs > UDP_PEER_TIMEOUT_MS) {
+        pPeers[i].lastSeenMs = 0;
+      }
+      return &pPeers[i];
+    }
+    if (pPeers[i].lastSeenMs < oldest->lastSeenMs) {
+      oldest = &pPeers[i];
+    }
+  }
+  oldest->ip = ip;
+  oldest->port = port;
+  oldest->lastSeenMs = 0;
+  return oldest;
+}
+
+uint8_t UdpControlClass::handleCommand(const UdpControlPacket& cmd, Peer *peer)
+{
+  int lights = pLightService->getLightsAvailable();
+  if (cmd.light > lights || (cmd.light > 0 && !pLightService->getLightHandler(cmd.light - 1))) {
+    return UDP_STATUS_BAD_LIGHT;
+  }
+  if (cmd.type == UDP_TYPE_GET) {
+    return UDP_STATUS_OK;
+  }
+  if (cmd.type != UDP_TYPE_SET) {
+    return UDP_STATUS_BAD_TYPE;
+  }
+  // lastSeenMs is 0 for a new or timed out sender, any sequence is accepted then
+  if (peer->lastSeenMs != 0) {
+    int16_t age = (int16_t)(cmd.seq - peer->seq);
+    if (age == 0) {
+      return UDP_STATUS_DUPLICATE;
+    }
+    if (age < 0) {
+      METRIC_INC(udp_rejected);
+      return UDP_STATUS_STALE;
+    }
+  }
+  peer->seq = cmd.seq;
+  peer->lastSeenMs = millis() | 1;
+  int first = cmd.light > 0 ? cmd.light - 1 : 0;
+  int last = cmd.light > 0 ? cmd.light - 1 : lights - 1;
+  for (int i = first; i <= last; i++) {
+    LightInfo newInfo = pLightService->getLightState(i);
+    if (cmd.flags & UDP_FLAG_ON) {
+      newInfo.on = cmd.on != 0;
+    }
+    if (cmd.flags & UDP_FLAG_BRI) {
+      newInfo.brightness = constrain(cmd.bri, 1, 254);
+    }
+    // same path as the Hue API, there is no JSON body
+    pLightService->applyLightState(i, newInfo, JsonObject::invalid());
+  }
+  return UDP_STATUS_OK;
+}
+
+// reply with the state of the light, the first light if the command was for all lights
+void UdpControlClass::sendStatus(const UdpControlPacket& cmd, uint8_t status)
+{
+  UdpControlPacket reply;
+  memset(&reply, 0, sizeof(reply));
+  reply.magic[0] = 'A';
+  reply.magic[1] = 'U';
+  reply.version = UDP_CONTROL_VERSION;
+  reply.type = UDP_TYPE_STATUS;
+  reply.seq = cmd.seq;
+  reply.light = cmd.light;
+  reply.status = status;
+  if (status != UDP_STATUS_DENIED && status != UDP_STATUS_BAD_LIGHT) {
+    const LightInfo& info = pLightService->getLightState(cmd.light > 0 ? cmd.light - 1 : 0);
+    reply.flags = UDP_FLAG_ON | UDP_FLAG_BRI;
+    reply.on = info.on;
+    reply.bri = info.brightness;
+  }
+  pUdp.beginPacket(pUdp.remoteIP(), pUdp.remotePort());
+  pUdp.write((const uint8_t*)&reply, sizeof(reply));
+  pUdp.endPacket();
+}
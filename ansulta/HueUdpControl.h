@@ -0,0 +1,99 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Compact binary UDP protocol to switch the lights without HTTP
+and JSON. Each command is answered with a status packet, a
+repeated sequence number is answered again but not applied twice.
+
+Packet (16 bytes, multi byte values little endian):
+  0  magic      'A' 'U'
+  2  version    UDP_CONTROL_VERSION
+  3  type       UDP_TYPE_*
+  4  seq        uint16, increased by the sender for each command
+  6  light      1-based light number, 0 for all lights
+  7  flags      UDP_FLAG_*, fields used by the command
+  8  on         0 or 1
+  9  bri        brightness 1..254
+ 10  status     UDP_STATUS_*, only in the reply
+ 11  reserved
+ 12  token      uint32, must match the configured token if not 0
+
+**************************************************************/
+#ifndef HUEUDPCONTROL_H
+#define HUEUDPCONTROL_H
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include "HueTypes.h"
+
+namespace hue {
+
+#define UDP_CONTROL_PORT 8266
+#define UDP_CONTROL_VERSION 1
+#define UDP_CONTROL_PEERS 4  // senders tracked for the sequence check
+
+#define UDP_TYPE_SET    0x01  // apply on/bri, reply with the new state
+#define UDP_TYPE_GET    0x02  // reply with the current state
+#define UDP_TYPE_STATUS 0x81  // reply
+
+#define UDP_FLAG_ON  0x01
+#define UDP_FLAG_BRI 0x02
+
+#define UDP_STATUS_OK        0x00
+#define UDP_STATUS_DUPLICATE 0x01  // seq already applied, the state is reported again
+#define UDP_STATUS_STALE     0x02  // seq older than the last one of this sender
+#define UDP_STATUS_BAD_LIGHT 0x03
+#define UDP_STATUS_DENIED    0x04  // wrong token
+#define UDP_STATUS_BAD_TYPE  0x05
+
+struct UdpControlPacket {
+  uint8_t magic[2];
+  uint8_t version;
+  uint8_t type;
+  uint16_t seq;
+  uint8_t light;
+  uint8_t flags;
+  uint8_t on;
+  uint8_t bri;
+  uint8_t status;
+  uint8_t reserved;
+  uint32_t token;
+} __attribute__((packed));
+
+class LightServiceClass;
+
+class UdpControlClass {
+  public:
+    UdpControlClass();
+    void begin(LightServiceClass *lightService, uint16_t port=UDP_CONTROL_PORT);
+    // 0 disables the token check
+    void setToken(uint32_t token);
+    // handles all pending packets, called from LightServiceClass::update()
+    void update();
+
+  protected:
+    struct Peer {
+      uint32_t ip;
+      uint16_t port;
+      uint16_t seq;  // last applied command
+      unsigned long lastSeenMs;  // 0 if no command was applied yet
+    };
+
+    WiFiUDP pUdp;
+    LightServiceClass *pLightService;
+    uint32_t pToken;
+    bool pStarted;
+    Peer pPeers[UDP_CONTROL_PEERS];
+
+    Peer *findPeer(uint32_t ip, uint16_t port);
+    uint8_t handleCommand(const UdpControlPacket& cmd, Peer *peer);
+    void sendStatus(const UdpControlPacket& cmd, uint8_t status);
+};
+
+};
+#endif
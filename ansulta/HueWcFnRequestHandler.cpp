@@ -14,6 +14,8 @@ https://github.com/probonopd/ESP8266HueEmulator
 **************************************************************/
 #include "HueWcFnRequestHandler.h"
 #include <assert.h>
+#include "trace.h"
+#include "HueRequestArena.h"
 
 using namespace hue;
 
@@ -22,6 +24,9 @@ WcFnRequestHandler::WcFnRequestHandler(WcFnHandlerFunction fn, const String &uri
 , _uri(uri)
 , _method(method)
 , _wildcard(wildcard)
+, _requestCount(0)
+, _latencyUsSum(0)
+, _latencyUsMax(0)
 {
     assert(_wildcard != '/');
     // verify that the URI is reasonable (only contains wildcard at the beginning/end/whole path segments
@@ -69,9 +74,19 @@ bool WcFnRequestHandler::canUpload(String requestUri)
 
 bool WcFnRequestHandler::handle(ESP8266WebServer& server, HTTPMethod requestMethod, String requestUri)
 {
+    unsigned long start = micros();
     currentReqUri = requestUri;
     _fn(this, requestUri, requestMethod);
     currentReqUri = "";
+    // all JSON buffers of the handler are released at this point
+    requestArena.reset();
+    uint32_t duration = micros() - start;
+    _requestCount++;
+    _latencyUsSum += duration;
+    if (duration > _latencyUsMax) {
+        _latencyUsMax = duration;
+    }
+    TRACE_EVENT(TRACE_HTTP_REQUEST, requestMethod, duration / 1000);
     return true;
 }
 
@@ -31,12 +31,20 @@ public:
     bool handle(ESP8266WebServer& server, HTTPMethod requestMethod, String requestUri) override;
     void upload(ESP8266WebServer& server, String requestUri, HTTPUpload& upload) override;
     String getWildCard(int wcIndex);
+    const String& getUri() const { return _uri; }
+    uint32_t getRequestCount() const { return _requestCount; }
+    uint64_t getLatencySum() const { return _latencyUsSum; }
+    uint32_t getLatencyMax() const { return _latencyUsMax; }
 protected:
     String currentReqUri;
     WcFnHandlerFunction _fn;
     String _uri;
     HTTPMethod _method;
     char _wildcard;
+    // statistics for the metrics endpoint
+    uint32_t _requestCount;
+    uint64_t _latencyUsSum;
+    uint32_t _latencyUsMax;
     
     String removeSlashes(String uri);
     String getPathSegment(String uri);
@@ -30,6 +30,7 @@ License (MIT license):
 #include "SSDP.h"
 #include "WiFiUdp.h"
 #include "debug.h"
+#include "metrics.h"
 
 extern "C" {
   #include "osapi.h"
@@ -56,17 +57,18 @@ static const IPAddress SSDP_MULTICAST_ADDR(239, 255, 255, 250);
 
 
 
-static const char* _ssdp_response_template =
+// the templates are read directly from flash
+static const char _ssdp_response_template[] PROGMEM =
   "HTTP/1.1 200 OK\r\n"
   "EXT:\r\n";
 
-static const char* _ssdp_notify_template =
+static const char _ssdp_notify_template[] PROGMEM =
   "NOTIFY * HTTP/1.1\r\n"
   "HOST: 239.255.255.250:1900\r\n"
   "NTS: ssdp:alive\r\n";
 
-static const char* _ssdp_packet_template =
-  "%s" // _ssdp_response_template / _ssdp_notify_template
+// appended to _ssdp_response_template / _ssdp_notify_template
+static const char _ssdp_packet_template[] PROGMEM =
   "CACHE-CONTROL: max-age=%u\r\n" // SSDP_INTERVAL
   "SERVER: FreeRTOS/6.0.5, UPnP/1.0, %s/%s\r\n" // _modelName, _modelNumber
   "USN: uuid:%s\r\n" // _uuid
@@ -74,7 +76,7 @@ static const char* _ssdp_packet_template =
   "LOCATION: http://%u.%u.%u.%u:%u/%s\r\n" // WiFi.localIP(), _port, _schemaURL
   "\r\n";
 
-static const char* _ssdp_schema_template =
+static const char _ssdp_schema_template[] PROGMEM =
   "HTTP/1.1 200 OK\r\n"
   "Content-Type: text/xml\r\n"
   "Connection: close\r\n"
@@ -206,9 +208,10 @@ void SSDPClass::_send(ssdp_method_t method){
   if (_messageFormatCallback) {
     len = _messageFormatCallback(this, buffer, sizeof(buffer), method != NONE, SSDP_INTERVAL, _modelName, _modelNumber, _uuid, _deviceType, ip.addr, _port, _schemaURL);
   } else {
-    len = snprintf(buffer, sizeof(buffer),
+    strcpy_P(buffer, (method == NONE)?_ssdp_response_template:_ssdp_notify_template);
+    int start = strlen(buffer);
+    len = start + snprintf_P(buffer + start, sizeof(buffer) - start,
       _ssdp_packet_template,
-      (method == NONE)?_ssdp_response_template:_ssdp_notify_template,
       SSDP_INTERVAL,
       _modelName, _modelNumber,
       _uuid,
@@ -223,12 +226,14 @@ void SSDPClass::_send(ssdp_method_t method){
   ip_addr_t remoteAddr;
   uint16_t remotePort;
   if(method == NONE) {
+    METRIC_INC(ssdp_responses);
     remoteAddr.addr = _respondToAddr;
     remotePort = _respondToPort;
 #ifdef DEBUG_SSDP
     DEBUG_SSDP.print("Sending Response to ");
 #endif
   } else {
+    METRIC_INC(ssdp_notifies);
     remoteAddr.addr = SSDP_MULTICAST_ADDR;
     remotePort = SSDP_PORT;
 #ifdef DEBUG_SSDP
@@ -247,7 +252,7 @@ void SSDPClass::_send(ssdp_method_t method){
 void SSDPClass::schema(WiFiClient client){
   ip4_addr ip;
   ip.addr = WiFi.localIP();
-  client.printf(_ssdp_schema_template,
+  client.printf_P(_ssdp_schema_template,
     IP2STR(&ip), _port,
     _deviceType,
     _friendlyName,
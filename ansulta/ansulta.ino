@@ -12,28 +12,38 @@
 #include "HueTypes.h"
 #include "HueLightService.h"
 #include "motion_detector.h"
+#include "mqtt_bridge.h"
+#include "metrics.h"
+#include "trace.h"
 
 
 Config cfg;
 OnBoardLED led;
 Ansulta ansulta;
 MotionDetector motion;
+MqttBridge mqtt;
 int motion_state = 0;
-bool saved_ansulta_address = false;
+uint32_t motion_snapshot_version = 0;
 hue::LightServiceClass lightService(1);
 
-// Handler used by LightServiceClass to switch the ansulta lights
-class AnsultaHandler : public hue::LightHandler {
+// Handler used by LightServiceClass to switch the ansulta lights.
+// Each state change of the ansulta light is pushed into the state cache of the LightServiceClass.
+class AnsultaHandler : public hue::LightHandler, public AnsultaCallback {
   private:
     hue::LightInfo _info;
   public:
     AnsultaHandler() {
-        _info.bulbType =  hue::BulbType::DIMMABLE_LIGHT;
+        _info.setBulbType(hue::BulbType::DIMMABLE_LIGHT);
     }
     String getFriendlyName(int lightNumber) const {
         return cfg.device_name;  // defined in config.h
     }
     void handleQuery(int lightNumber, hue::LightInfo newInfo, JsonObject& raw) {
+        // the ansulta light knows only on/off and two brightness levels, skip the radio for other changes
+        if ((newInfo.diff(getInfo(lightNumber)) & (LIGHT_CHANGED_ON | LIGHT_CHANGED_BRI)) == 0) {
+            DEBUG_PRINTLN("light state unchanged, skip radio");
+            return;
+        }
         int brightness = newInfo.brightness;
         DEBUG_PRINT("ON: ");
         DEBUG_PRINTLN(newInfo.on);
@@ -74,8 +84,51 @@ class AnsultaHandler : public hue::LightHandler {
         }
         return _info;
     }
+    void startSearch(int lightNumber) {
+        // the next frame of an Ansulta remote sets the address
+        ansulta.start_learning();
+    }
+    void stopSearch(int lightNumber) {
+        ansulta.stop_learning();
+    }
+    hue::SearchState getSearchState(int lightNumber) {
+        switch (ansulta.get_learn_state()) {
+            case Ansulta::LEARN_LISTENING:
+                // the listening without an address runs in the background, it is no search
+                return ansulta.is_searching() ? hue::SEARCH_ACTIVE : hue::SEARCH_IDLE;
+            case Ansulta::LEARN_FOUND:
+                return hue::SEARCH_FOUND;
+            default:
+                return hue::SEARCH_IDLE;
+        }
+    }
+    void light_state_changed(int state, bool by_ansulta_ctrl) {
+        // also called for the commands sent by handleQuery()
+        lightService.notifyLightState(0, getInfo(0));
+    }
 };
 
+// passes the motion detector readings to the /sensors API if they changed
+void push_sensor_state()
+{
+    const MotionSnapshot& snapshot = motion.get_snapshot();
+    if (snapshot.version == motion_snapshot_version) {
+        return;
+    }
+    motion_snapshot_version = snapshot.version;
+    hue::SensorState state;
+    state.presence = snapshot.presence;
+    // scale the 10 bit ADC value to the 16 bit range of the Hue API
+    state.lightlevel = snapshot.light_level * 64;
+    state.tholddark = snapshot.dark_threshold * 64;
+    state.dark = snapshot.light_level <= snapshot.dark_threshold;
+    state.suppressed = snapshot.suppressed;
+    state.suppressedSeconds = snapshot.suppressed_ms / 1000;
+    state.presenceUpdated = snapshot.presence_changed;
+    state.lightlevelUpdated = snapshot.light_level_changed;
+    lightService.notifySensorState(state);
+}
+
 // defines used to set NTP date
 #define TZ              1       // (utc+) TZ in hours
 #define DST_MN          0      // use 60mn for summer time in some countries
@@ -96,8 +149,9 @@ void setup()
     // init blue LED on board
     led.init();
     cfg.setup();
-    saved_ansulta_address = ansulta.set_address(cfg.get_ansulta_address_a(), cfg.get_ansulta_address_b());
+    ansulta.set_address(cfg.get_ansulta_address_a(), cfg.get_ansulta_address_b());
     lightService.begin();
+    lightService.setUdpToken(cfg.udp_token);
     settimeofday_cb(time_is_set);
     // Sync our clock to NTP
     configTime(TZ_SEC, DST_SEC, "pool.ntp.org");
@@ -105,24 +159,28 @@ void setup()
     DEBUG_PRINTLN("Adding ansulta light switch");
     AnsultaHandler* ansulta_handler = new AnsultaHandler();
     lightService.setLightHandler(0, *ansulta_handler);
+    ansulta.add_handler(ansulta_handler);
     motion.init(ansulta, cfg.motion_timeout, cfg.max_photo_intensity);
     ansulta.add_handler(&motion);
+    mqtt.init(lightService, cfg.mqtt_server, cfg.mqtt_prefix);
 }
  
 void loop()
 {
+    unsigned long loop_start_us = micros();
     led.set_connection_state(led.NOT_CONNECTED);
     if (cfg.is_connected()) {
         lightService.update();
+        mqtt.loop();
         delay(10);
         if (ansulta.valid_address()) {
-           if (!saved_ansulta_address) {
+           // a search for new lights can learn another remote
+           if (ansulta.get_address_a() != cfg.get_ansulta_address_a() || ansulta.get_address_b() != cfg.get_ansulta_address_b()) {
               DEBUG_PRINT("ANSULTA ADDR: A");
               DEBUG_PRINT(ansulta.get_address_a());
               DEBUG_PRINT(",B:");
               DEBUG_PRINTLN(ansulta.get_address_b());
               cfg.save_ansulta_address(ansulta.get_address_a(), ansulta.get_address_b());
-              saved_ansulta_address = true;
            }
            led.set_connection_state(led.OK);
         } else {
@@ -148,7 +206,13 @@ void loop()
                 led.blink(mresult, 1000 * mresult);
             }
             motion_state = mresult;
+            mqtt.set_motion_state(mresult);
         }
+        push_sensor_state();
     }
+    metrics_observe_loop(micros() - loop_start_us);
+#ifdef TRACE
+    trace_drain_serial();
+#endif
 }
 
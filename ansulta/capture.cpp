@@ -0,0 +1,197 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Capture of the received radio frames. The CC2500 appends the
+RSSI and LQI/CRC_OK status bytes to each frame (APPEND_STATUS
+of PKTCTRL1). The frames are kept in a RAM ring and dumped in
+pcap format by GET /capture.pcap, decode it on the host with
+tools/capture_decode.py. The RSSI histograms per remote address
+are exported in /metrics.
+
+**************************************************************/
+#include "capture.h"
+#include "metrics.h"
+
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+static CaptureRecord capture_ring[CAPTURE_RING_SIZE];
+static uint16_t capture_head = 0;
+static uint16_t capture_tail = 0;
+// frames overwritten before they were dumped
+static uint32_t capture_dropped = 0;
+// the last entry collects the addresses not fitting into the table
+static CaptureStats capture_stats[CAPTURE_MAX_ADDRESSES + 1];
+
+int capture_rssi_dbm(uint8_t rssi)
+{
+    return (int8_t)rssi / 2 - CAPTURE_RSSI_OFFSET;
+}
+
+static CaptureStats& capture_stats_of(uint16_t address)
+{
+    for (int i = 0; i < CAPTURE_MAX_ADDRESSES; i++) {
+        CaptureStats& stats = capture_stats[i];
+        if (!stats.used) {
+            stats.used = true;
+            stats.address = address;
+            return stats;
+        }
+        if (stats.address == address) {
+            return stats;
+        }
+    }
+    return capture_stats[CAPTURE_MAX_ADDRESSES];
+}
+
+void capture_frame(const uint8_t *data, uint8_t length, uint8_t orig_length, bool has_status, uint16_t address)
+{
+    CaptureRecord& record = capture_ring[capture_head++ & (CAPTURE_RING_SIZE - 1)];
+    record.ts_ms = millis();
+    record.orig_length = orig_length;
+    record.length = length < CAPTURE_SNAPLEN ? length : CAPTURE_SNAPLEN;
+    memcpy(record.data, data, record.length);
+
+    CaptureStats& stats = capture_stats_of(address);
+    stats.frames++;
+    if (!has_status) {
+        return;
+    }
+    uint8_t lqi = data[length - 1];
+    int dbm = capture_rssi_dbm(data[length - 2]);
+    if (!(lqi & CAPTURE_CRC_OK)) {
+        stats.crc_errors++;
+    }
+    stats.lqi_sum += lqi & ~CAPTURE_CRC_OK;
+    stats.rssi_sum += dbm;
+    int bucket = (dbm + 99) / 10;  // -90 and below in the first bucket
+    if (dbm <= -90) {
+        bucket = 0;
+    } else if (bucket > CAPTURE_RSSI_BUCKETS) {
+        bucket = CAPTURE_RSSI_BUCKETS;
+    }
+    stats.rssi_buckets[bucket]++;
+}
+
+uint16_t capture_pending()
+{
+    uint16_t pending = capture_head - capture_tail;
+    if (pending > CAPTURE_RING_SIZE) {
+        capture_dropped += pending - CAPTURE_RING_SIZE;
+        capture_tail = capture_head - CAPTURE_RING_SIZE;
+        pending = CAPTURE_RING_SIZE;
+    }
+    return pending;
+}
+
+size_t capture_dump_size(uint16_t count)
+{
+    size_t size = PCAP_HEADER_SIZE;
+    uint16_t pending = capture_pending();
+    for (uint16_t i = 0; i < count && i < pending; i++) {
+        size += PCAP_RECORD_HEADER_SIZE + capture_ring[(capture_tail + i) & (CAPTURE_RING_SIZE - 1)].length;
+    }
+    return size;
+}
+
+static void put_u32(uint8_t *buffer, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        buffer[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+void capture_dump(Print& out, uint16_t count)
+{
+    uint16_t pending = capture_pending();
+    if (count > pending) {
+        count = pending;
+    }
+    // pcap header: magic, version 2.4, time zone, accuracy, snaplen, link type (little endian)
+    uint8_t header[PCAP_HEADER_SIZE];
+    put_u32(header, 0xA1B2C3D4);
+    header[4] = 2;
+    header[5] = 0;
+    header[6] = 4;
+    header[7] = 0;
+    put_u32(header + 8, 0);
+    put_u32(header + 12, 0);
+    put_u32(header + 16, CAPTURE_SNAPLEN);
+    put_u32(header + 20, CAPTURE_LINKTYPE);
+    out.write(header, sizeof(header));
+    // the time stamps are the uptime
+    for (uint16_t i = 0; i < count; i++) {
+        const CaptureRecord& record = capture_ring[capture_tail++ & (CAPTURE_RING_SIZE - 1)];
+        put_u32(header, record.ts_ms / 1000);
+        put_u32(header + 4, (record.ts_ms % 1000) * 1000);
+        put_u32(header + 8, record.length);
+        put_u32(header + 12, record.orig_length);
+        out.write(header, PCAP_RECORD_HEADER_SIZE);
+        out.write(record.data, record.length);
+    }
+}
+
+void capture_print_metrics(String& out)
+{
+    static const int8_t bounds[CAPTURE_RSSI_BUCKETS] = { -90, -80, -70, -60, -50, -40, -30 };
+    char labels[48];
+    capture_pending();
+    metrics_add_header(out, F("ansulta_capture_dropped_total"), F("counter"), F("Captured frames overwritten before /capture.pcap was read."));
+    metrics_add_value(out, F("ansulta_capture_dropped_total"), NULL, capture_dropped);
+    metrics_add_header(out, F("ansulta_radio_rx_frames_total"), F("counter"), F("Received frames per remote address, 0000 are frames of no Ansulta remote."));
+    for (int i = 0; i <= CAPTURE_MAX_ADDRESSES; i++) {
+        const CaptureStats& stats = capture_stats[i];
+        if (!stats.used && i < CAPTURE_MAX_ADDRESSES) {
+            continue;
+        }
+        if (i < CAPTURE_MAX_ADDRESSES) {
+            snprintf_P(labels, sizeof(labels), PSTR("address=\"%04X\""), stats.address);
+        } else {
+            strcpy_P(labels, PSTR("address=\"other\""));
+        }
+        metrics_add_value(out, F("ansulta_radio_rx_frames_total"), labels, stats.frames);
+    }
+    metrics_add_header(out, F("ansulta_radio_rx_crc_errors_total"), F("counter"), F("Received frames with wrong CRC per remote address."));
+    for (int i = 0; i < CAPTURE_MAX_ADDRESSES && capture_stats[i].used; i++) {
+        snprintf_P(labels, sizeof(labels), PSTR("address=\"%04X\""), capture_stats[i].address);
+        metrics_add_value(out, F("ansulta_radio_rx_crc_errors_total"), labels, capture_stats[i].crc_errors);
+    }
+    metrics_add_header(out, F("ansulta_radio_rx_lqi"), F("summary"), F("Link quality indicator of the received frames, lower is better."));
+    for (int i = 0; i < CAPTURE_MAX_ADDRESSES && capture_stats[i].used; i++) {
+        const CaptureStats& stats = capture_stats[i];
+        uint32_t count = 0;
+        for (int b = 0; b <= CAPTURE_RSSI_BUCKETS; b++) {
+            count += stats.rssi_buckets[b];
+        }
+        snprintf_P(labels, sizeof(labels), PSTR("address=\"%04X\""), stats.address);
+        metrics_add_value(out, F("ansulta_radio_rx_lqi_sum"), labels, stats.lqi_sum);
+        metrics_add_value(out, F("ansulta_radio_rx_lqi_count"), labels, count);
+    }
+    metrics_add_header(out, F("ansulta_radio_rx_rssi_dbm"), F("histogram"), F("Signal strength of the received frames per remote address."));
+    for (int i = 0; i < CAPTURE_MAX_ADDRESSES && capture_stats[i].used; i++) {
+        const CaptureStats& stats = capture_stats[i];
+        uint32_t count = 0;
+        for (int b = 0; b <= CAPTURE_RSSI_BUCKETS; b++) {
+            count += stats.rssi_buckets[b];
+            if (b < CAPTURE_RSSI_BUCKETS) {
+                snprintf_P(labels, sizeof(labels), PSTR("address=\"%04X\",le=\"%d\""), stats.address, bounds[b]);
+            } else {
+                snprintf_P(labels, sizeof(labels), PSTR("address=\"%04X\",le=\"+Inf\""), stats.address);
+            }
+            metrics_add_value(out, F("ansulta_radio_rx_rssi_dbm_bucket"), labels, count);
+        }
+        snprintf_P(labels, sizeof(labels), PSTR("address=\"%04X\""), stats.address);
+        // the sum is negative, metrics_add_value only writes unsigned values
+        out += F("ansulta_radio_rx_rssi_dbm_sum{");
+        out += labels;
+        out += F("} ");
+        out += stats.rssi_sum;
+        out += '\n';
+        metrics_add_value(out, F("ansulta_radio_rx_rssi_dbm_count"), labels, count);
+    }
+}
@@ -0,0 +1,65 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Capture of the received radio frames. The CC2500 appends the
+RSSI and LQI/CRC_OK status bytes to each frame (APPEND_STATUS
+of PKTCTRL1). The frames are kept in a RAM ring and dumped in
+pcap format by GET /capture.pcap, decode it on the host with
+tools/capture_decode.py. The RSSI histograms per remote address
+are exported in /metrics.
+
+**************************************************************/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <Arduino.h>
+
+#define CAPTURE_RING_SIZE     32    // frames, must be a power of two
+#define CAPTURE_SNAPLEN       16    // bytes kept of a frame: length byte, payload and the status bytes
+#define CAPTURE_MAX_ADDRESSES 4     // remotes with own statistics, the others are counted as unknown
+#define CAPTURE_RSSI_BUCKETS  7     // upper bounds -90, -80 .. -30 dBm and +Inf
+#define CAPTURE_RSSI_OFFSET   72    // RSSI offset of the CC2500 at 250 kBaud
+#define CAPTURE_LINKTYPE      147   // LINKTYPE_USER0
+#define CAPTURE_CRC_OK        0x80  // in the second status byte, the lower 7 bits are the LQI
+
+struct CaptureRecord {
+    uint32_t ts_ms;
+    uint8_t orig_length;  // bytes in the FIFO: length byte, payload and status bytes
+    uint8_t length;       // bytes kept in data
+    uint8_t data[CAPTURE_SNAPLEN];
+};
+
+// frames of one remote address, address 0 are frames which are no Ansulta command
+struct CaptureStats {
+    bool used;
+    uint16_t address;  // address A << 8 | address B
+    uint32_t frames;
+    uint32_t crc_errors;
+    uint32_t lqi_sum;
+    int32_t rssi_sum;  // dBm
+    uint32_t rssi_buckets[CAPTURE_RSSI_BUCKETS + 1];
+};
+
+/** Converts the RSSI status byte to dBm. */
+int capture_rssi_dbm(uint8_t rssi);
+/**
+ * Adds a received frame. data is the FIFO content: the length byte, the payload and the two
+ * status bytes, length the bytes read of it. address is A << 8 | B of a decoded Ansulta frame,
+ * 0 otherwise.
+ */
+void capture_frame(const uint8_t *data, uint8_t length, uint8_t orig_length, bool has_status, uint16_t address);
+/** Number of frames not yet dumped, at most CAPTURE_RING_SIZE. */
+uint16_t capture_pending();
+/** Size of a pcap dump with count frames, header included. */
+size_t capture_dump_size(uint16_t count);
+/** Writes the oldest count pending frames as pcap file and removes them from the ring. */
+void capture_dump(Print& out, uint16_t count);
+/** Appends the frame counters and RSSI histograms per address. */
+void capture_print_metrics(String& out);
+
+#endif
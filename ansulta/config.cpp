@@ -33,6 +33,9 @@ Config::Config()
     device_name = HUE_DEVICE_NAME;
     motion_timeout = MOTION_TIMEOUT;
     max_photo_intensity = MAX_PHOTO_INTENSITY; 
+    udp_token = 0;
+    mqtt_server = "";
+    mqtt_prefix = "ansulta";
     pShouldSaveConfig = false;
     pAnsultaAddressA = 0x00;
     pAnsultaAddressB = 0x00;
@@ -86,6 +89,11 @@ void Config::setup()
                     pAnsultaAddressB = json["ansulta_address_b"].as<byte>();
                     motion_timeout = json["motion_timeout"].as<int>();
                     max_photo_intensity = json["max_photo_intensity"].as<int>();
+                    udp_token = json["udp_token"].as<unsigned long>();
+                    if (json.containsKey("mqtt_server")) {
+                        mqtt_server = json["mqtt_server"].as<String>();
+                        mqtt_prefix = json["mqtt_prefix"].as<String>();
+                    }
                     p_has_motion = motion_timeout > 0;
                     DEBUG_PRINT("Readed ansulta address, A:");
                     DEBUG_PRINT(pAnsultaAddressA);
@@ -111,6 +119,14 @@ void Config::setup()
     sprintf(MAX_PHOTO_INTENSITY_STR, "%d", max_photo_intensity);
     WiFiManagerParameter custom_ansulta_max_photo_intensity("max_photo_intensity", MAX_PHOTO_INTENSITY_STR, MAX_PHOTO_INTENSITY_STR, 5);
     wifiManager.addParameter(&custom_ansulta_max_photo_intensity);
+    char UDP_TOKEN_STR[11];
+    sprintf(UDP_TOKEN_STR, "%lu", udp_token);
+    WiFiManagerParameter custom_ansulta_udp_token("udp_token", UDP_TOKEN_STR, UDP_TOKEN_STR, 11);
+    wifiManager.addParameter(&custom_ansulta_udp_token);
+    WiFiManagerParameter custom_ansulta_mqtt_server("mqtt_server", "MQTT broker host[:port]", mqtt_server.c_str(), 64);
+    wifiManager.addParameter(&custom_ansulta_mqtt_server);
+    WiFiManagerParameter custom_ansulta_mqtt_prefix("mqtt_prefix", "MQTT topic prefix", mqtt_prefix.c_str(), 32);
+    wifiManager.addParameter(&custom_ansulta_mqtt_prefix);
     wifiManager.setSaveConfigCallback(saveConfigCallback);
     wifiManager.setConnectTimeout(60);
     bool wifi_connected = false;
@@ -131,6 +147,9 @@ void Config::setup()
     DEBUG_PRINTLN("connected...yeey :)");
     device_name = custom_ansulta_name.getValue();
     motion_timeout = atoi(custom_ansulta_motion_timeout.getValue());
+    udp_token = strtoul(custom_ansulta_udp_token.getValue(), NULL, 10);
+    mqtt_server = custom_ansulta_mqtt_server.getValue();
+    mqtt_prefix = custom_ansulta_mqtt_prefix.getValue();
     p_has_motion = motion_timeout > 0;
 
     if (pShouldSaveConfig) {
@@ -189,6 +208,9 @@ void Config::p_save_config()
     json["ansulta_address_b"] = pAnsultaAddressB;
     json["motion_timeout"] = motion_timeout;
     json["max_photo_intensity"] = max_photo_intensity;
+    json["udp_token"] = udp_token;
+    json["mqtt_server"] = mqtt_server;
+    json["mqtt_prefix"] = mqtt_prefix;
     File configFile = SPIFFS.open(CONFIG_FILE, "w");
     if (!configFile) {
         DEBUG_PRINTLN("failed to open config file for writing");
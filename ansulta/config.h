@@ -39,6 +39,9 @@ public:
     String device_name;
     unsigned long motion_timeout;
     int max_photo_intensity;
+    unsigned long udp_token;  // shared secret of the UDP control, 0 disables the check
+    String mqtt_server;  // host[:port] of the MQTT broker, empty disables MQTT
+    String mqtt_prefix;  // prefix of all MQTT topics
     Config();
     ~Config();
     void setup();
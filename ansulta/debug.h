@@ -1,6 +1,8 @@
 #include <SPI.h>
 
 // #define DEBUG //"Schalter" zum aktivieren
+// #define TRACE //binary event trace of the hot paths, see trace.h
+// #define TX_PER_PACKET //send each repeated packet with IDLE, flush and STX like the original remote code
 
 // do not change
 #ifdef DEBUG
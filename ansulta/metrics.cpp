@@ -0,0 +1,85 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Counters for the /metrics endpoint (Prometheus text format).
+The counters are plain integers, incrementing one costs only
+a few cycles on the hot paths.
+
+**************************************************************/
+#include "metrics.h"
+
+Metrics metrics = {};
+
+void metrics_add_header(String& out, const __FlashStringHelper* name, const __FlashStringHelper* type, const __FlashStringHelper* help)
+{
+    out += F("# HELP ");
+    out += name;
+    out += ' ';
+    out += help;
+    out += F("\n# TYPE ");
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void metrics_add_value(String& out, const __FlashStringHelper* name, const char* labels, uint64_t value)
+{
+    // String has no 64 bit constructor
+    char digits[21];
+    char* pos = digits + sizeof(digits) - 1;
+    *pos = '\0';
+    do {
+        *--pos = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    out += name;
+    if (labels != NULL) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += pos;
+    out += '\n';
+}
+
+static void metrics_add(String& out, const __FlashStringHelper* name, const __FlashStringHelper* type, const __FlashStringHelper* help, uint64_t value)
+{
+    metrics_add_header(out, name, type, help);
+    metrics_add_value(out, name, NULL, value);
+}
+
+void metrics_print(String& out)
+{
+    metrics_add_header(out, F("ansulta_loop_duration_microseconds"), F("summary"), F("Duration of the main loop iterations."));
+    metrics_add_value(out, F("ansulta_loop_duration_microseconds_sum"), NULL, metrics.loop_us_sum);
+    metrics_add_value(out, F("ansulta_loop_duration_microseconds_count"), NULL, metrics.loop_count);
+    metrics_add(out, F("ansulta_loop_duration_max_microseconds"), F("gauge"), F("Longest main loop iteration since start."), metrics.loop_us_max);
+    metrics_add(out, F("ansulta_radio_tx_bursts_total"), F("counter"), F("Commands sent to the lights."), metrics.radio_tx_bursts);
+    metrics_add(out, F("ansulta_radio_tx_packets_total"), F("counter"), F("Radio packets sent, each command is repeated."), metrics.radio_tx_packets);
+    metrics_add(out, F("ansulta_radio_tx_backoffs_total"), F("counter"), F("Backoffs of a command because the channel was busy."), metrics.radio_tx_backoffs);
+    metrics_add(out, F("ansulta_radio_tx_forced_total"), F("counter"), F("Commands sent on a busy channel after all backoffs, probably collided."), metrics.radio_tx_forced);
+    metrics_add(out, F("ansulta_radio_tx_replaced_total"), F("counter"), F("Commands replaced by a newer one while waiting for the channel."), metrics.radio_tx_replaced);
+    metrics_add(out, F("ansulta_radio_tx_delay_ms_total"), F("counter"), F("Milliseconds the commands waited for a clear channel."), metrics.radio_tx_delay_ms);
+    metrics_add(out, F("ansulta_radio_rx_decoded_total"), F("counter"), F("Received packets decoded as Ansulta remote command."), metrics.radio_rx_decoded);
+    metrics_add(out, F("ansulta_radio_rx_rejected_total"), F("counter"), F("Received packets which are no Ansulta remote command."), metrics.radio_rx_rejected);
+    metrics_add(out, F("ansulta_radio_rx_overflows_total"), F("counter"), F("Overflows of the RX FIFO, the frames in it are lost."), metrics.radio_rx_overflows);
+    metrics_add(out, F("ansulta_radio_calibrations_total"), F("counter"), F("Calibrations of the frequency synthesizer."), metrics.radio_calibrations);
+    metrics_add(out, F("ansulta_ssdp_responses_total"), F("counter"), F("SSDP search queries answered."), metrics.ssdp_responses);
+    metrics_add(out, F("ansulta_ssdp_notifies_total"), F("counter"), F("SSDP alive notifications sent."), metrics.ssdp_notifies);
+    metrics_add(out, F("ansulta_udp_commands_total"), F("counter"), F("UDP control packets received."), metrics.udp_commands);
+    metrics_add(out, F("ansulta_udp_rejected_total"), F("counter"), F("UDP control packets ignored because of a bad format, token or sequence."), metrics.udp_rejected);
+    metrics_add(out, F("ansulta_mqtt_connects_total"), F("counter"), F("Connection attempts to the MQTT broker."), metrics.mqtt_connects);
+    metrics_add(out, F("ansulta_mqtt_publishes_total"), F("counter"), F("MQTT messages published."), metrics.mqtt_publishes);
+    metrics_add(out, F("ansulta_mqtt_commands_total"), F("counter"), F("MQTT light commands received."), metrics.mqtt_commands);
+    metrics_add(out, F("ansulta_heap_free_bytes"), F("gauge"), F("Free heap."), ESP.getFreeHeap());
+    metrics_add(out, F("ansulta_heap_max_block_bytes"), F("gauge"), F("Largest free block on the heap."), ESP.getMaxFreeBlockSize());
+    metrics_add(out, F("ansulta_heap_fragmentation_percent"), F("gauge"), F("Heap fragmentation, 0 is no fragmentation."), ESP.getHeapFragmentation());
+    metrics_add(out, F("ansulta_uptime_milliseconds"), F("counter"), F("Milliseconds since start, wraps after 49 days."), millis());
+}
@@ -0,0 +1,68 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Counters for the /metrics endpoint (Prometheus text format).
+The counters are plain integers, incrementing one costs only
+a few cycles on the hot paths.
+
+**************************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+struct Metrics {
+    // main loop
+    uint32_t loop_count;
+    uint64_t loop_us_sum;
+    uint32_t loop_us_max;
+    // CC2500 radio
+    uint32_t radio_tx_bursts;
+    uint32_t radio_tx_packets;
+    uint32_t radio_tx_backoffs;
+    uint32_t radio_tx_forced;
+    uint32_t radio_tx_replaced;
+    uint32_t radio_tx_delay_ms;
+    uint32_t radio_rx_decoded;
+    uint32_t radio_rx_rejected;
+    uint32_t radio_rx_overflows;
+    uint32_t radio_calibrations;
+    // SSDP discovery
+    uint32_t ssdp_responses;
+    uint32_t ssdp_notifies;
+    // UDP control
+    uint32_t udp_commands;
+    uint32_t udp_rejected;
+    // MQTT bridge
+    uint32_t mqtt_connects;
+    uint32_t mqtt_publishes;
+    uint32_t mqtt_commands;
+};
+
+extern Metrics metrics;
+
+#define METRIC_INC(name) (metrics.name++)
+#define METRIC_ADD(name, value) (metrics.name += (value))
+
+/** Adds the duration of one loop() iteration in microseconds. */
+inline void metrics_observe_loop(uint32_t duration_us) {
+    metrics.loop_count++;
+    metrics.loop_us_sum += duration_us;
+    if (duration_us > metrics.loop_us_max) {
+        metrics.loop_us_max = duration_us;
+    }
+}
+
+/** Appends the HELP and TYPE lines of a metric. */
+void metrics_add_header(String& out, const __FlashStringHelper* name, const __FlashStringHelper* type, const __FlashStringHelper* help);
+/** Appends a sample line, labels can be NULL or e.g. 'route="/api"'. */
+void metrics_add_value(String& out, const __FlashStringHelper* name, const char* labels, uint64_t value);
+/** Appends all metrics collected in this module, the heap state included. */
+void metrics_print(String& out);
+
+#endif
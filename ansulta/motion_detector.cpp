@@ -29,6 +29,9 @@ MotionDetector::MotionDetector() {
     p_light_ts_manual_intervantion = 0;
     p_disable_duration = 0;
     p_photo_state_smooth = 25;
+    p_light_level_smooth = 25;
+    p_light_level_ts_sample = 0;
+    memset(&p_snapshot, 0, sizeof(p_snapshot));
 }
 
 void MotionDetector::init(Ansulta& ansulta, unsigned long timeout, int max_photo_intensity) {
@@ -37,12 +40,56 @@ void MotionDetector::init(Ansulta& ansulta, unsigned long timeout, int max_photo
     p_timeout_default = timeout;
     p_timeout = timeout;
     pinMode(p_md1_pin, INPUT);
+    p_snapshot.dark_threshold = max_photo_intensity;
+    p_snapshot.light_level = p_light_level_smooth;
+    // the initial state is reported once
+    p_snapshot.version = 1;
 }
 
 int MotionDetector::loop() {
     if (p_ansulta == NULL) {
         return 0;
     }
+    p_update_snapshot();
+    return p_handle_motion();
+}
+
+const MotionSnapshot& MotionDetector::get_snapshot() {
+    return p_snapshot;
+}
+
+// compares the sensors with the snapshot, the version changes only on an edge
+void MotionDetector::p_update_snapshot() {
+    unsigned long current_time = msecs();
+    bool changed = false;
+    bool presence = digitalRead(p_md1_pin) == HIGH;
+    if (presence != p_snapshot.presence) {
+        p_snapshot.presence = presence;
+        p_snapshot.presence_changed = time(nullptr);
+        changed = true;
+    }
+    if (current_time - p_light_level_ts_sample >= LIGHT_LEVEL_SAMPLE_MS) {
+        p_light_level_ts_sample = current_time;
+        // own smoothing, the motion path samples p_photo_state_smooth only while the lamp is off
+        p_light_level_smooth = p_light_level_smooth * 0.8 + analogRead(p_photo_pin) * 0.2;
+        if (abs(p_light_level_smooth - p_snapshot.light_level) >= LIGHT_LEVEL_HYSTERESIS) {
+            p_snapshot.light_level = p_light_level_smooth;
+            p_snapshot.light_level_changed = time(nullptr);
+            changed = true;
+        }
+    }
+    bool suppressed = current_time - p_motion_ts_deactivated < p_disable_duration;
+    if (suppressed != p_snapshot.suppressed || (suppressed && p_disable_duration != p_snapshot.suppressed_ms)) {
+        p_snapshot.suppressed = suppressed;
+        p_snapshot.suppressed_ms = suppressed ? p_disable_duration : 0;
+        changed = true;
+    }
+    if (changed) {
+        p_snapshot.version++;
+    }
+}
+
+int MotionDetector::p_handle_motion() {
     unsigned long current_time = msecs();
     if (current_time - p_motion_ts_deactivated < p_disable_duration) {
         // motion detection for 1h deactivated
@@ -10,6 +10,22 @@ This class handles the detected motions.
  **************************************************************/
 #include "Ansulta.h" 
 #include "config.h"
+#include <time.h>
+
+#define LIGHT_LEVEL_SAMPLE_MS 5000  // interval to read the photo sensor
+#define LIGHT_LEVEL_HYSTERESIS 8    // smaller changes of the smoothed value are not reported
+
+// Sensor readings, updated by loop() only if a value changed.
+struct MotionSnapshot {
+    bool presence;
+    int light_level;             // smoothed photo sensor value 0..1023
+    int dark_threshold;          // lights are switched by motion at or below this level
+    bool suppressed;             // motion detection disabled by the remote
+    unsigned long suppressed_ms; // duration of the suppression
+    time_t presence_changed;
+    time_t light_level_changed;
+    uint32_t version;            // increased on each change
+};
 
 class MotionDetector : public AnsultaCallback {
   public:
@@ -17,6 +33,7 @@ class MotionDetector : public AnsultaCallback {
     void init(Ansulta& p_ansulta, unsigned long timeout=20000, int max_photo_intensity=120);
     int loop();
     void light_state_changed(int state, bool by_ansulta_ctrl);
+    const MotionSnapshot& get_snapshot();
     
     unsigned long msecs();
     
@@ -32,10 +49,16 @@ class MotionDetector : public AnsultaCallback {
     int p_count_detected;
     unsigned long p_disable_duration;
     int p_photo_state_smooth;
+    int p_light_level_smooth;
     
     unsigned long p_md1_ts_detection;
     unsigned long p_motion_ts_deactivated;
     unsigned long p_light_ts_manual_off;
     unsigned long p_light_ts_manual_intervantion;
+    unsigned long p_light_level_ts_sample;
+    MotionSnapshot p_snapshot;
+
+    int p_handle_motion();
+    void p_update_snapshot();
     
 };
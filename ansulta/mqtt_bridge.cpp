@@ -0,0 +1,211 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Publishes the light and motion state to a MQTT broker and
+switches the lights on commands received by MQTT.
+
+**************************************************************/
+#include "mqtt_bridge.h"
+#include <ArduinoJson.h>
+#include "debug.h"
+#include "metrics.h"
+
+MqttBridge::MqttBridge() : p_client(p_wifi_client)
+{
+    p_light_service = NULL;
+    p_enabled = false;
+    p_host[0] = '\0';
+    p_port = MQTT_DEFAULT_PORT;
+    p_prefix[0] = '\0';
+    p_client_id[0] = '\0';
+    p_backoff_ms = 0;
+    p_ts_last_connect = 0;
+    p_published_version = 0;
+    p_motion_dirty = false;
+    p_motion_state = 0;
+    p_ts_last_publish = 0;
+}
+
+void MqttBridge::init(hue::LightServiceClass& light_service, const String& server, const String& prefix)
+{
+    p_light_service = &light_service;
+    p_enabled = server.length() > 0;
+    if (!p_enabled) {
+        DEBUG_PRINTLN("MQTT disabled");
+        return;
+    }
+    strlcpy(p_host, server.c_str(), sizeof(p_host));
+    char *port = strchr(p_host, ':');
+    if (port != NULL) {
+        *port = '\0';
+        p_port = atoi(port + 1);
+    }
+    strlcpy(p_prefix, prefix.length() > 0 ? prefix.c_str() : "ansulta", sizeof(p_prefix));
+    snprintf(p_client_id, sizeof(p_client_id), "ansulta-%06x", ESP.getChipId());
+    p_client.setServer(p_host, p_port);
+    p_client.setCallback(std::bind(&MqttBridge::p_on_message, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    DEBUG_PRINT("MQTT broker: ");
+    DEBUG_PRINT(p_host);
+    DEBUG_PRINT(":");
+    DEBUG_PRINTLN(p_port);
+}
+
+void MqttBridge::loop()
+{
+    if (!p_enabled || WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    if (!p_client.connected()) {
+        p_reconnect();
+        return;
+    }
+    p_client.loop();
+    // collect the changes, the state is read at publish time
+    uint32_t version = p_light_service->getStateVersion();
+    if (version != p_published_version) {
+        hue::LightMask changed = p_light_service->changedSince(p_published_version);
+        for (int i = changed.first(); i >= 0; i = changed.next(i)) {
+            p_dirty_lights.set(i);
+        }
+        p_published_version = version;
+    }
+    if (millis() - p_ts_last_publish >= MQTT_PUBLISH_INTERVAL_MS) {
+        p_publish_pending();
+    }
+}
+
+void MqttBridge::set_motion_state(int state)
+{
+    if (state != p_motion_state) {
+        p_motion_state = state;
+        p_motion_dirty = true;
+    }
+}
+
+bool MqttBridge::is_connected()
+{
+    return p_enabled && p_client.connected();
+}
+
+// one connect attempt, the time between the attempts doubles up to MQTT_BACKOFF_MAX_MS
+void MqttBridge::p_reconnect()
+{
+    if (p_backoff_ms > 0 && millis() - p_ts_last_connect < p_backoff_ms) {
+        return;
+    }
+    p_ts_last_connect = millis();
+    char status_topic[MQTT_TOPIC_SIZE];
+    p_topic(status_topic, "status");
+    // a broker in the local network answers fast, do not stall the radio loop for the default 5s
+    p_wifi_client.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
+    METRIC_INC(mqtt_connects);
+    if (!p_client.connect(p_client_id, status_topic, 0, true, "offline")) {
+        p_backoff_ms = p_backoff_ms == 0 ? MQTT_BACKOFF_MIN_MS : min(p_backoff_ms * 2, (unsigned long)MQTT_BACKOFF_MAX_MS);
+        DEBUG_PRINT("MQTT connect failed, state: ");
+        DEBUG_PRINT(p_client.state());
+        DEBUG_PRINT(", retry in ms: ");
+        DEBUG_PRINTLN(p_backoff_ms);
+        return;
+    }
+    DEBUG_PRINTLN("MQTT connected");
+    p_backoff_ms = 0;
+    p_client.publish(status_topic, "online", true);
+    char set_topic[MQTT_TOPIC_SIZE];
+    snprintf(set_topic, sizeof(set_topic), "%s/light/+/set", p_prefix);
+    p_client.subscribe(set_topic);
+    // the broker may have lost the retained states
+    p_dirty_lights.setAll();
+    p_motion_dirty = true;
+}
+
+void MqttBridge::p_publish_pending()
+{
+    int count = 0;
+    int lights = p_light_service->getLightsAvailable();
+    for (int i = p_dirty_lights.first(); i >= 0 && count < MQTT_MAX_PUBLISH_PER_LOOP; i = p_dirty_lights.next(i)) {
+        if (i >= lights || p_publish_light(i)) {
+            p_dirty_lights.clear(i);
+        }
+        count++;
+    }
+    if (p_motion_dirty && count < MQTT_MAX_PUBLISH_PER_LOOP) {
+        char topic[MQTT_TOPIC_SIZE];
+        char payload[8];
+        p_topic(topic, "motion");
+        snprintf(payload, sizeof(payload), "%d", p_motion_state);
+        if (p_client.publish(topic, payload, true)) {
+            METRIC_INC(mqtt_publishes);
+            p_motion_dirty = false;
+        }
+        count++;
+    }
+    if (count > 0) {
+        p_ts_last_publish = millis();
+    }
+}
+
+bool MqttBridge::p_publish_light(int light)
+{
+    const hue::LightInfo& info = p_light_service->getLightState(light);
+    char topic[MQTT_TOPIC_SIZE];
+    char payload[32];
+    p_topic(topic, "state", light);
+    snprintf(payload, sizeof(payload), "{\"on\":%s,\"bri\":%u}", info.on ? "true" : "false", info.brightness);
+    if (!p_client.publish(topic, payload, true)) {
+        return false;
+    }
+    METRIC_INC(mqtt_publishes);
+    return true;
+}
+
+// <prefix>/light/<n>/set, runs inside of p_client.loop()
+void MqttBridge::p_on_message(char* topic, byte* payload, unsigned int length)
+{
+    size_t prefix_length = strlen(p_prefix);
+    int light_number = 0;
+    char suffix[4] = {};
+    if (strncmp(topic, p_prefix, prefix_length) != 0
+        || sscanf(topic + prefix_length, "/light/%d/%3s", &light_number, suffix) != 2
+        || strcmp(suffix, "set") != 0) {
+        return;
+    }
+    int light = light_number - 1;
+    if (light < 0 || light >= p_light_service->getLightsAvailable()) {
+        return;
+    }
+    METRIC_INC(mqtt_commands);
+    StaticJsonBuffer<128> json_buffer;
+    char body[64];
+    length = min(length, (unsigned int)sizeof(body) - 1);
+    memcpy(body, payload, length);
+    body[length] = '\0';
+    JsonObject& root = json_buffer.parseObject(body);
+    if (!root.success()) {
+        DEBUG_PRINT("MQTT invalid payload: ");
+        DEBUG_PRINTLN(body);
+        return;
+    }
+    hue::LightInfo new_info = p_light_service->getLightState(light);
+    if (root.containsKey("on")) {
+        new_info.on = root["on"].as<bool>();
+    }
+    if (root.containsKey("bri")) {
+        new_info.brightness = constrain(root["bri"].as<int>(), 1, 254);
+    }
+    // same path as the Hue API, the new state is published by the state cache
+    p_light_service->applyLightState(light, new_info, root);
+}
+
+void MqttBridge::p_topic(char* buffer, const char* suffix, int light)
+{
+    if (light >= 0) {
+        snprintf(buffer, MQTT_TOPIC_SIZE, "%s/light/%d/%s", p_prefix, light + 1, suffix);
+    } else {
+        snprintf(buffer, MQTT_TOPIC_SIZE, "%s/%s", p_prefix, suffix);
+    }
+}
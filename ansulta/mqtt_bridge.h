@@ -0,0 +1,71 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Publishes the light and motion state to a MQTT broker and
+switches the lights on commands received by MQTT.
+Uses PubSubClient [https://github.com/knolleary/pubsubclient].
+
+Topics, <prefix> is configured in the web configuration portal:
+  <prefix>/light/<n>/state  {"on":true,"bri":254}, retained
+  <prefix>/light/<n>/set    same payload, "on" and "bri" are optional
+  <prefix>/motion           state returned by MotionDetector::loop(), retained
+  <prefix>/status           "online" or "offline" (last will), retained
+
+**************************************************************/
+#ifndef MQTT_BRIDGE_H
+#define MQTT_BRIDGE_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+#include "HueLightService.h"
+
+#define MQTT_DEFAULT_PORT 1883
+#define MQTT_TOPIC_SIZE 64
+#define MQTT_CONNECT_TIMEOUT_MS 300     // bounds the blocking TCP connect
+#define MQTT_BACKOFF_MIN_MS 1000
+#define MQTT_BACKOFF_MAX_MS 60000
+#define MQTT_PUBLISH_INTERVAL_MS 100    // changes within this time are sent as one message per light
+#define MQTT_MAX_PUBLISH_PER_LOOP 4
+
+class MqttBridge {
+  public:
+    MqttBridge();
+    // server is "host" or "host:port", an empty server disables the bridge
+    void init(hue::LightServiceClass& light_service, const String& server, const String& prefix);
+    void loop();
+    void set_motion_state(int state);
+    bool is_connected();
+
+  private:
+    WiFiClient p_wifi_client;
+    PubSubClient p_client;
+    hue::LightServiceClass* p_light_service;
+    bool p_enabled;
+    char p_host[64];
+    uint16_t p_port;
+    char p_prefix[MQTT_TOPIC_SIZE - 24];
+    char p_client_id[24];
+    // reconnect
+    unsigned long p_backoff_ms;
+    unsigned long p_ts_last_connect;
+    // coalesced publish
+    uint32_t p_published_version;
+    hue::LightMask p_dirty_lights;
+    bool p_motion_dirty;
+    int p_motion_state;
+    unsigned long p_ts_last_publish;
+
+    void p_reconnect();
+    void p_publish_pending();
+    bool p_publish_light(int light);
+    void p_on_message(char* topic, byte* payload, unsigned int length);
+    void p_topic(char* buffer, const char* suffix, int light=-1);
+};
+
+#endif
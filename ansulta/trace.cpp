@@ -0,0 +1,89 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Low overhead tracing into a RAM ring. Each event is stored as
+8 byte binary record, no text is formatted in the hot paths.
+The ring is drained lazily to Serial or by GET /trace and
+decoded on the host by tools/trace_decode.py.
+Enable by defining TRACE in debug.h.
+
+**************************************************************/
+#include "trace.h"
+
+#ifdef TRACE
+
+#define TRACE_HEADER_SIZE 12
+
+TraceRecord trace_ring[TRACE_RING_SIZE];
+uint16_t trace_head = 0;
+static uint16_t trace_tail = 0;
+// records overwritten before they were drained
+static uint32_t trace_dropped = 0;
+
+uint16_t trace_pending()
+{
+    uint16_t pending = trace_head - trace_tail;
+    if (pending > TRACE_RING_SIZE) {
+        trace_dropped += pending - TRACE_RING_SIZE;
+        trace_tail = trace_head - TRACE_RING_SIZE;
+        pending = TRACE_RING_SIZE;
+    }
+    return pending;
+}
+
+size_t trace_dump_size(uint16_t count)
+{
+    return TRACE_HEADER_SIZE + count * sizeof(TraceRecord);
+}
+
+void trace_dump(Print& out, uint16_t count)
+{
+    uint16_t pending = trace_pending();
+    if (count > pending) {
+        count = pending;
+    }
+    // header: magic, version, record size, record count, dropped records (little endian)
+    uint8_t header[TRACE_HEADER_SIZE];
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    header[5] = sizeof(TraceRecord);
+    header[6] = count & 0xFF;
+    header[7] = count >> 8;
+    for (int i = 0; i < 4; i++) {
+        header[8 + i] = (trace_dropped >> (8 * i)) & 0xFF;
+    }
+    out.write(header, sizeof(header));
+    // the records are contiguous up to the end of the ring
+    while (count > 0) {
+        uint16_t index = trace_tail & (TRACE_RING_SIZE - 1);
+        uint16_t chunk = TRACE_RING_SIZE - index;
+        if (chunk > count) {
+            chunk = count;
+        }
+        out.write((const uint8_t*)&trace_ring[index], chunk * sizeof(TraceRecord));
+        trace_tail += chunk;
+        count -= chunk;
+    }
+    trace_dropped = 0;
+}
+
+void trace_drain_serial()
+{
+    uint16_t pending = trace_pending();
+    if (pending == 0) {
+        return;
+    }
+    int space = Serial.availableForWrite() - TRACE_HEADER_SIZE;
+    if (space < (int)sizeof(TraceRecord)) {
+        return;
+    }
+    uint16_t count = space / sizeof(TraceRecord);
+    trace_dump(Serial, count < pending ? count : pending);
+}
+
+#endif
@@ -0,0 +1,71 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Low overhead tracing into a RAM ring. Each event is stored as
+8 byte binary record, no text is formatted in the hot paths.
+The ring is drained lazily to Serial or by GET /trace and
+decoded on the host by tools/trace_decode.py.
+Enable by defining TRACE in debug.h.
+
+**************************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include "debug.h"
+
+// event ids, keep in sync with EVENTS in tools/trace_decode.py
+#define TRACE_TX_BURST      0x01  // arg0: command, arg1: packet count
+#define TRACE_TX_PACKET     0x02  // arg0: packet index
+#define TRACE_TX_DONE       0x03  // arg0: command
+#define TRACE_RADIO_CAL     0x04  // arg0: FSCAL1, arg1: FSCAL3 << 8 | FSCAL2
+#define TRACE_TX_BACKOFF    0x05  // arg0: command, arg1: backoff number
+#define TRACE_RX_PACKET     0x10  // arg0: packet length
+#define TRACE_RX_COMMAND    0x11  // arg0: command, arg1: address A << 8 | address B
+#define TRACE_RX_REJECTED   0x12  // arg0: packet length
+#define TRACE_LIGHT_STATE   0x20  // arg0: state, arg1: 1 if changed by the Ansulta remote
+#define TRACE_HTTP_REQUEST  0x30  // arg0: HTTP method, arg1: duration in milliseconds
+
+#define TRACE_RING_SIZE     256   // records, must be a power of two
+#define TRACE_MAGIC         "ATRC"
+#define TRACE_VERSION       1
+
+struct TraceRecord {
+    uint32_t ts_us;
+    uint8_t id;
+    uint8_t arg0;
+    uint16_t arg1;
+};
+
+#ifdef TRACE
+extern TraceRecord trace_ring[TRACE_RING_SIZE];
+extern uint16_t trace_head;
+
+inline void trace_event(uint8_t id, uint8_t arg0, uint16_t arg1) {
+    TraceRecord& record = trace_ring[trace_head++ & (TRACE_RING_SIZE - 1)];
+    record.ts_us = micros();
+    record.id = id;
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+}
+
+/** Number of records not yet drained, at most TRACE_RING_SIZE. */
+uint16_t trace_pending();
+/** Size of a dump with count records, header included. */
+size_t trace_dump_size(uint16_t count);
+/** Writes a dump with the oldest count pending records and removes them from the ring. */
+void trace_dump(Print& out, uint16_t count);
+/** Writes pending records to Serial as long as this does not block. */
+void trace_drain_serial();
+
+#define TRACE_EVENT(id, arg0, arg1) trace_event(id, arg0, arg1)
+#else
+#define TRACE_EVENT(id, arg0, arg1)
+#endif
+
+#endif
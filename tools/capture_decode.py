@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Decodes the radio capture of esp8266-ansulta-alexa.
+
+The capture is a pcap file (link type USER0), each packet is the RX FIFO
+content of the CC2500: length byte, payload, RSSI and LQI/CRC_OK status.
+
+    curl -s http://<ip>/capture.pcap > capture.pcap
+    python3 tools/capture_decode.py capture.pcap
+
+The time stamps are the uptime of the device. Each frame is printed with
+its signal quality and why it was not accepted as Ansulta command, a
+summary per remote address follows.
+"""
+import struct
+import sys
+
+PCAP_HEADER = struct.Struct('<IHHiIII')
+RECORD_HEADER = struct.Struct('<IIII')
+LINKTYPE_USER0 = 147
+# keep in sync with CAPTURE_RSSI_OFFSET in ansulta/capture.h
+RSSI_OFFSET = 72
+CRC_OK = 0x80
+COMMANDS = {0x01: 'OFF', 0x02: 'ON_50', 0x03: 'ON_100', 0xFF: 'PAIR'}
+
+
+def rssi_dbm(raw):
+    if raw >= 128:
+        raw -= 256
+    # like the division of the firmware, rounded towards zero
+    return int(raw / 2) - RSSI_OFFSET
+
+
+def frames(data):
+    if len(data) < PCAP_HEADER.size:
+        sys.exit('no pcap file')
+    magic, major, minor, _, _, _, linktype = PCAP_HEADER.unpack_from(data)
+    if magic != 0xA1B2C3D4 or linktype != LINKTYPE_USER0:
+        sys.exit('unknown capture format')
+    pos = PCAP_HEADER.size
+    while pos + RECORD_HEADER.size <= len(data):
+        sec, usec, length, orig_length = RECORD_HEADER.unpack_from(data, pos)
+        pos += RECORD_HEADER.size
+        if pos + length > len(data):
+            sys.stderr.write('truncated capture\n')
+            return
+        yield sec + usec / 1e6, data[pos:pos + length], orig_length
+        pos += length
+
+
+def decode(frame, orig_length):
+    """Returns (address, command, status) of the frame, status is None for an Ansulta command."""
+    if len(frame) < orig_length:
+        return None, None, 'not read, %d bytes' % (orig_length - 3)
+    payload = frame[1:-2]
+    start = payload.find(b'\x55')
+    if start < 0:
+        return None, None, 'no start byte'
+    if start + 6 > len(payload):
+        return None, None, 'short frame'
+    if payload[start + 1] != 0x01 or payload[start + 5] != 0xAA:
+        return None, None, 'bad framing'
+    return (payload[start + 2] << 8) | payload[start + 3], payload[start + 4], None
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('usage: %s <capture file>' % sys.argv[0])
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+    summary = {}
+    for ts, frame, orig_length in frames(data):
+        address, command, status = decode(frame, orig_length)
+        text = frame.hex()
+        if len(frame) == orig_length and len(frame) >= 3:
+            dbm = rssi_dbm(frame[-2])
+            lqi = frame[-1] & ~CRC_OK
+            crc = frame[-1] & CRC_OK
+            text += '  rssi=%ddBm lqi=%d %s' % (dbm, lqi, 'crc ok' if crc else 'CRC ERROR')
+        else:
+            dbm = None
+            crc = True
+        if status is None:
+            text += '  address=%04X cmd=%s' % (address, COMMANDS.get(command, '0x%02X' % command))
+        else:
+            text += '  rejected: ' + status
+        print('%12.3f  %s' % (ts, text))
+        stats = summary.setdefault('%04X' % address if address is not None else 'rejected', [0, 0, []])
+        stats[0] += 1
+        if not crc:
+            stats[1] += 1
+        if dbm is not None:
+            stats[2].append(dbm)
+    for key, (count, crc_errors, rssi) in sorted(summary.items()):
+        line = '%-9s frames=%d crc_errors=%d' % (key, count, crc_errors)
+        if rssi:
+            line += ' rssi min/avg/max=%d/%d/%d dBm' % (min(rssi), sum(rssi) // len(rssi), max(rssi))
+        print(line)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,70 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Minimal replacement of the Arduino core for the host checks in
+this directory, only what the tested sources need.
+
+**************************************************************/
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define strlen_P strlen
+#define snprintf_P snprintf
+
+using std::min;
+using std::max;
+
+// pins and timing, the radio code only needs them to link
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define SS 15
+#define MISO 12
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) {}
+inline int digitalRead(uint8_t pin) { return LOW; }  // the chip is always ready
+inline void delay(unsigned long ms) {}
+inline void delayMicroseconds(unsigned int us) {}
+inline unsigned long millis() { return 0; }
+inline unsigned long micros() { return 0; }
+inline long random(long howbig) { return howbig ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall + random(howbig - howsmall); }
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+
+class String : public std::string {
+  public:
+    String() {}
+    String(const char *s) : std::string(s) {}
+    String(const std::string& s) : std::string(s) {}
+    explicit String(int value) : std::string(std::to_string(value)) {}
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(const uint8_t *buffer, size_t size) { return size; }
+};
+
+#endif
@@ -0,0 +1,19 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+The host checks do not parse JSON, the types are only declared
+for the signatures of the tested headers.
+
+**************************************************************/
+#ifndef HOST_ARDUINOJSON_H
+#define HOST_ARDUINOJSON_H
+
+class JsonObject;
+class JsonArray;
+
+#endif
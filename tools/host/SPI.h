@@ -0,0 +1,26 @@
+// debug.h includes the SPI library, the host checks talk to no chip
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {}
+};
+
+class SPIClass {
+  public:
+    void begin() {}
+    void beginTransaction(SPISettings settings) {}
+    void endTransaction() {}
+    uint8_t transfer(uint8_t data) { return 0; }
+    void writeBytes(const uint8_t *data, uint32_t size) {}
+};
+
+static SPIClass SPI __attribute__((unused));
+
+#endif
@@ -0,0 +1,107 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Compares the lookup tables of HueColorTables.h with the float
+formulas they replaced and measures both on the host:
+  - mirek to RGB must be identical for 153..500
+  - the sRGB gamma must stay below 0.5 LSB of the 8 bit output
+
+  g++ -std=c++11 -O2 -Itools/host -Iansulta tools/host/color_tables_check.cpp ansulta/HueColorTables.cpp -o color_tables_check
+
+**************************************************************/
+#include <stdio.h>
+#include <chrono>
+#include "HueColorTables.h"
+
+using namespace hue;
+
+// getMirektoRGB() before the tables
+static rgbcolor floatMirekToRGB(int mirek)
+{
+  int hectemp = 10000 / mirek;
+  int r, g, b;
+  if (hectemp <= 66) {
+    r = COLOR_SATURATION;
+    g = 99.4708025861 * log(hectemp) - 161.1195681661;
+    b = hectemp <= 19 ? 0 : (138.5177312231 * log(hectemp - 10) - 305.0447927307);
+  } else {
+    r = 329.698727446 * pow(hectemp - 60, -0.1332047592);
+    g = 288.1221695283 * pow(hectemp - 60, -0.0755148492);
+    b = COLOR_SATURATION;
+  }
+  r = r > COLOR_SATURATION ? COLOR_SATURATION : r;
+  g = g > COLOR_SATURATION ? COLOR_SATURATION : g;
+  b = b > COLOR_SATURATION ? COLOR_SATURATION : b;
+  return rgbcolor(r, g, b);
+}
+
+// gamma correction of getXYtoRGB() before the tables
+static float floatGamma(float v)
+{
+  return v <= 0.0031308f ? 12.92f * v : (1.0f + 0.055f) * pow(v, (1.0f / 2.4f)) - 0.055f;
+}
+
+template<typename F>
+static double nanosPerCall(F fn, int calls)
+{
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / calls;
+}
+
+int main()
+{
+  int failures = 0;
+  for (int mirek = MIREK_MIN; mirek <= MIREK_MAX; mirek++) {
+    rgbcolor expected = floatMirekToRGB(mirek);
+    rgbcolor actual = mirekToRGB(mirek);
+    if (expected.r != actual.r || expected.g != actual.g || expected.b != actual.b) {
+      printf("mirek %d: table %d/%d/%d, float %d/%d/%d\n", mirek, actual.r, actual.g, actual.b, expected.r, expected.g, expected.b);
+      failures++;
+    }
+  }
+  printf("mirek: %d of %d values differ\n", failures, MIREK_MAX - MIREK_MIN + 1);
+
+  const int steps = 1000000;
+  double maxError = 0.0;
+  float worst = 0.0f;
+  for (int i = 0; i <= steps; i++) {
+    float linear = (float)i / steps;
+    double error = fabs(gammaCorrect(linear) - floatGamma(linear)) * 255.0;
+    if (error > maxError) {
+      maxError = error;
+      worst = linear;
+    }
+  }
+  printf("gamma: max error %.3f LSB at %.6f\n", maxError, worst);
+  if (maxError >= 0.5) {
+    failures++;
+  }
+
+  // the sums keep the compiler from dropping the loops
+  volatile uint32_t sink = 0;
+  const int calls = 10000000;
+  double tableMirek = nanosPerCall([&]() {
+    for (int i = 0; i < calls; i++) sink += mirekToRGB(MIREK_MIN + i % (MIREK_MAX - MIREK_MIN + 1)).g;
+  }, calls);
+  double floatMirek = nanosPerCall([&]() {
+    for (int i = 0; i < calls; i++) sink += floatMirekToRGB(MIREK_MIN + i % (MIREK_MAX - MIREK_MIN + 1)).g;
+  }, calls);
+  double tableGamma = nanosPerCall([&]() {
+    for (int i = 0; i < calls; i++) sink += (uint32_t)(gammaCorrect((i & 0xFFFF) / 65536.0f) * 255.0f);
+  }, calls);
+  double floatGammaNs = nanosPerCall([&]() {
+    for (int i = 0; i < calls; i++) sink += (uint32_t)(floatGamma((i & 0xFFFF) / 65536.0f) * 255.0f);
+  }, calls);
+  printf("mirek: table %.1f ns, float %.1f ns per call\n", tableMirek, floatMirek);
+  printf("gamma: table %.1f ns, float %.1f ns per call\n", tableGamma, floatGammaNs);
+
+  printf(failures ? "FAILED\n" : "OK\n");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,287 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Fuzz test and benchmark of Ansulta::decode_frame() of the RX path.
+The decoder is compared with a plain reference on random and
+truncated buffers, on length bytes beyond RX_FRAME_MAX and on
+streams of back to back frames read in random FIFO chunks like
+read_cmd() does. Each buffer is copied to a heap block of its exact
+size, so a build with -fsanitize=address catches any overread.
+
+  g++ -std=c++11 -O2 -Itools/host -Iansulta -include Arduino.h -include vector \
+      tools/host/frame_decoder_fuzz.cpp ansulta/Ansulta.cpp -o frame_decoder_fuzz
+  add -fsanitize=address,undefined for the sanitizer run
+
+**************************************************************/
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <Arduino.h>
+#include "Ansulta.h"
+#include "metrics.h"
+#include "capture.h"
+
+#define RANDOM_BUFFERS 2000000
+#define STREAM_FRAMES 2000000
+#define BENCH_ROUNDS 20
+
+// only the decoder is tested, the counters and the capture of the radio code are not needed
+Metrics metrics = {};
+void capture_frame(const uint8_t *data, uint8_t length, uint8_t orig_length, bool has_status, uint16_t address) {}
+void AnsultaCallback::light_state_changed(int state, bool by_ansulta_ctrl) {}
+
+static int errors = 0;
+
+// decode_frame() as the spec of read_cmd() describes it, without any shortcut
+static AnsultaFrame reference(const std::vector<byte>& data)
+{
+  AnsultaFrame frame = {};
+  frame.type = FRAME_INCOMPLETE;
+  if (data.empty()) {
+    return frame;
+  }
+  if (data[0] > RX_FRAME_MAX) {
+    frame.type = FRAME_INVALID;
+    frame.length = 1;
+    return frame;
+  }
+  int length = data[0];
+  if ((int)data.size() < length + 3) {
+    return frame;
+  }
+  frame.type = FRAME_REJECTED;
+  frame.length = length + 3;
+  frame.rssi = data[length + 1];
+  frame.lqi = data[length + 2];
+  for (int i = 1; i + ANSULTA_FRAME_SIZE <= length + 1; i++) {
+    if (data[i] == 0x55 && data[i + 1] == 0x01 && data[i + 5] == 0xAA) {
+      frame.type = FRAME_COMMAND;
+      frame.address_a = data[i + 2];
+      frame.address_b = data[i + 3];
+      frame.command = data[i + 4];
+      break;
+    }
+  }
+  return frame;
+}
+
+// decodes a copy in a heap block of the exact size
+static AnsultaFrame decode(const byte *data, int size)
+{
+  byte *copy = new byte[size > 0 ? size : 1];
+  if (size > 0) {
+    memcpy(copy, data, size);
+  }
+  AnsultaFrame frame = {};
+  AnsultaFrameType type = Ansulta::decode_frame(copy, size, frame);
+  delete[] copy;
+  if (type != frame.type) {
+    printf("returned type %d, frame type %d\n", type, frame.type);
+    errors++;
+  }
+  return frame;
+}
+
+static bool same(const AnsultaFrame& a, const AnsultaFrame& b)
+{
+  if (a.type != b.type) {
+    return false;
+  }
+  if (a.type == FRAME_INCOMPLETE) {
+    return true;
+  }
+  if (a.length != b.length) {
+    return false;
+  }
+  if (a.type == FRAME_INVALID) {
+    return true;
+  }
+  if (a.rssi != b.rssi || a.lqi != b.lqi) {
+    return false;
+  }
+  return a.type != FRAME_COMMAND ||
+         (a.address_a == b.address_a && a.address_b == b.address_b && a.command == b.command);
+}
+
+static void check(const std::vector<byte>& data, const char *test)
+{
+  AnsultaFrame expected = reference(data);
+  AnsultaFrame actual = decode(data.data(), data.size());
+  if (!same(expected, actual)) {
+    if (errors < 10) {
+      printf("%s: %zu bytes, length byte %d: type %d/%d, length %d/%d\n", test, data.size(),
+             data.empty() ? -1 : data[0], actual.type, expected.type, actual.length, expected.length);
+    }
+    errors++;
+  }
+}
+
+// a frame as the radio puts it into the RX FIFO, random payload or an Ansulta command after some noise
+static std::vector<byte> randomFrame(std::mt19937& random, AnsultaFrame& expected)
+{
+  std::vector<byte> frame;
+  int length = random() % (RX_FRAME_MAX + 1);
+  frame.push_back(length);
+  for (int i = 0; i < length; i++) {
+    frame.push_back(random());
+  }
+  if (length >= ANSULTA_FRAME_SIZE && random() % 2) {
+    int start = 1 + random() % (length - ANSULTA_FRAME_SIZE + 1);
+    byte command[ANSULTA_FRAME_SIZE] = {0x55, 0x01, (byte)random(), (byte)random(), (byte)random(), 0xAA};
+    memcpy(&frame[start], command, ANSULTA_FRAME_SIZE);
+  }
+  frame.push_back(random());  // RSSI
+  frame.push_back(random());  // LQI and CRC_OK
+  expected = reference(frame);
+  return frame;
+}
+
+static void testRandomBuffers(std::mt19937& random)
+{
+  std::vector<byte> data;
+  for (int n = 0; n < RANDOM_BUFFERS; n++) {
+    data.resize(random() % (RX_BUFFER_SIZE + 1));
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = random();
+    }
+    // keep the length byte mostly valid, otherwise nearly all buffers are FRAME_INVALID
+    if (!data.empty() && random() % 4) {
+      data[0] %= RX_FRAME_MAX + 1;
+    }
+    check(data, "random");
+  }
+}
+
+static void testTruncated(std::mt19937& random)
+{
+  for (int n = 0; n < 20000; n++) {
+    AnsultaFrame expected;
+    std::vector<byte> frame = randomFrame(random, expected);
+    for (size_t size = 0; size <= frame.size(); size++) {
+      std::vector<byte> prefix(frame.begin(), frame.begin() + size);
+      AnsultaFrame actual = decode(prefix.data(), prefix.size());
+      bool ok = size < frame.size() ? actual.type == FRAME_INCOMPLETE : same(expected, actual);
+      if (!ok) {
+        printf("truncated: %zu of %zu bytes decoded as type %d\n", size, frame.size(), actual.type);
+        errors++;
+      }
+    }
+  }
+}
+
+static void testInvalidLength(std::mt19937& random)
+{
+  for (int length = RX_FRAME_MAX + 1; length <= 255; length++) {
+    for (int size = 1; size <= RX_BUFFER_SIZE; size++) {
+      std::vector<byte> data(size);
+      for (int i = 0; i < size; i++) {
+        data[i] = random();
+      }
+      data[0] = length;
+      AnsultaFrame actual = decode(data.data(), size);
+      if (actual.type != FRAME_INVALID || actual.length != 1) {
+        printf("length byte %d, %d bytes: type %d, length %d\n", length, size, actual.type, actual.length);
+        errors++;
+      }
+    }
+  }
+}
+
+// frames back to back, read in random chunks into a buffer of RX_BUFFER_SIZE like read_cmd()
+static void testStream(std::mt19937& random)
+{
+  std::vector<byte> stream;
+  std::vector<AnsultaFrame> expected;
+  for (int n = 0; n < STREAM_FRAMES; n++) {
+    AnsultaFrame frame;
+    std::vector<byte> bytes = randomFrame(random, frame);
+    stream.insert(stream.end(), bytes.begin(), bytes.end());
+    expected.push_back(frame);
+  }
+
+  byte buffer[RX_BUFFER_SIZE];
+  int fill = 0;
+  size_t read = 0;
+  size_t decoded = 0;
+  while (read < stream.size() || fill > 0) {
+    int chunk = std::min((size_t)(1 + random() % RX_FIFO_SIZE), stream.size() - read);
+    chunk = std::min(chunk, RX_BUFFER_SIZE - fill);
+    memcpy(buffer + fill, stream.data() + read, chunk);
+    fill += chunk;
+    read += chunk;
+    int pos = 0;
+    while (pos < fill) {
+      AnsultaFrame frame = decode(buffer + pos, fill - pos);
+      if (frame.type == FRAME_INCOMPLETE) {
+        break;
+      }
+      if (decoded >= expected.size() || !same(expected[decoded], frame)) {
+        printf("stream: frame %zu decoded as type %d, length %d\n", decoded, frame.type, frame.length);
+        errors++;
+        return;
+      }
+      decoded++;
+      pos += frame.length;
+    }
+    fill -= pos;
+    memmove(buffer, buffer + pos, fill);
+    if (chunk == 0 && pos == 0) {
+      printf("stream: %d bytes left at the end\n", fill);
+      errors++;
+      return;
+    }
+  }
+  if (decoded != expected.size()) {
+    printf("stream: %zu of %zu frames decoded\n", decoded, expected.size());
+    errors++;
+  }
+}
+
+static void benchmark(std::mt19937& random)
+{
+  std::vector<byte> stream;
+  int frames = 0;
+  while (stream.size() < 1000000) {
+    AnsultaFrame expected;
+    std::vector<byte> bytes = randomFrame(random, expected);
+    stream.insert(stream.end(), bytes.begin(), bytes.end());
+    frames++;
+  }
+  // the sum keeps the compiler from dropping the loop
+  volatile uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    size_t pos = 0;
+    AnsultaFrame frame;
+    while (Ansulta::decode_frame(stream.data() + pos, stream.size() - pos, frame) != FRAME_INCOMPLETE) {
+      sink += frame.type + frame.command;
+      pos += frame.length;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  printf("decode: %.1f ns per frame, %zu bytes in %d frames\n",
+         std::chrono::duration<double, std::nano>(end - start).count() / frames / BENCH_ROUNDS, stream.size(), frames);
+}
+
+int main()
+{
+  std::mt19937 random(42);
+  testRandomBuffers(random);
+  printf("random: %d buffers of up to %d bytes\n", RANDOM_BUFFERS, RX_BUFFER_SIZE);
+  testTruncated(random);
+  printf("truncated: all prefixes of 20000 frames\n");
+  testInvalidLength(random);
+  printf("invalid: length bytes %d..255\n", RX_FRAME_MAX + 1);
+  testStream(random);
+  printf("stream: %d frames back to back\n", STREAM_FRAMES);
+  benchmark(random);
+
+  printf(errors ? "FAILED\n" : "OK\n");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Soak test of the LightGroupPool of HueLightGroup.h: random scene
+churn like the Hue app produces over weeks of uptime. Checks the
+free list on each step and compares the fragmentation of a
+simulated ESP8266 heap with the former new/delete of records
+holding two heap Strings.
+
+  g++ -std=c++11 -O2 -Itools/host -Iansulta tools/host/group_pool_soak.cpp -o group_pool_soak
+  add -DMAX_LIGHT_GROUPS=64 for the capacity of a real Hue bridge
+
+**************************************************************/
+#include <stdio.h>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+#include <Arduino.h>
+#include "HueLightGroup.h"
+
+using namespace hue;
+
+#define POOL_SIZE (2 * MAX_LIGHT_GROUPS)  // like LightServiceClass::pGroupPool
+#define SOAK_STEPS 10000000
+
+class JsonObject {};
+
+// only the pool is tested, the JSON parts of the record are not needed
+LightGroup::LightGroup() {}
+void LightGroup::init(JsonObject& root) {}
+
+// First fit heap with 8 byte blocks like the umm_malloc of the ESP8266 core,
+// the host malloc would hide the fragmentation of a small heap.
+class SimHeap {
+  public:
+    SimHeap(size_t size) { pFree[0] = size; }
+    // returns the offset or -1
+    long allocate(size_t size) {
+      size = (size + 4 + 7) & ~7;  // block header
+      for (auto it = pFree.begin(); it != pFree.end(); ++it) {
+        if (it->second >= size) {
+          size_t offset = it->first;
+          size_t rest = it->second - size;
+          pFree.erase(it);
+          if (rest) {
+            pFree[offset + size] = rest;
+          }
+          pUsed[offset] = size;
+          return offset;
+        }
+      }
+      return -1;
+    }
+    void release(long offset) {
+      size_t size = pUsed[offset];
+      pUsed.erase(offset);
+      auto next = pFree.find(offset + size);
+      if (next != pFree.end()) {
+        size += next->second;
+        pFree.erase(next);
+      }
+      auto it = pFree.insert(std::make_pair((size_t)offset, size)).first;
+      if (it != pFree.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second == (size_t)offset) {
+          prev->second += size;
+          pFree.erase(it);
+        }
+      }
+    }
+    size_t freeBytes() const {
+      size_t sum = 0;
+      for (auto& block : pFree) sum += block.second;
+      return sum;
+    }
+    size_t largestFree() const {
+      size_t largest = 0;
+      for (auto& block : pFree) largest = std::max(largest, block.second);
+      return largest;
+    }
+
+  protected:
+    std::map<size_t, size_t> pFree;
+    std::map<size_t, size_t> pUsed;
+};
+
+// former LightGroup from new: the object and the buffers of the name and id Strings
+struct HeapGroup {
+  long object;
+  long name;
+  long id;
+};
+
+#define HEAP_SIZE 24576       // free heap of the sketch after the start
+#define HEAP_STEPS 2000000
+#define RECORD_SIZE 40        // LightGroup with two String objects and the light mask
+
+static double fragmentation(const SimHeap& heap)
+{
+  size_t free = heap.freeBytes();
+  return free ? 100.0 * (free - heap.largestFree()) / free : 0.0;
+}
+
+// scene churn together with the JSON buffers of the requests, returns the worst fragmentation in percent
+static double heapSoak(bool pooled, std::mt19937& random, size_t& largest)
+{
+  SimHeap heap(HEAP_SIZE);
+  double worst = 0.0;
+  largest = HEAP_SIZE;
+  std::vector<HeapGroup> groups;
+  for (long step = 0; step < HEAP_STEPS; step++) {
+    if (!pooled) {
+      bool release = !groups.empty() && (groups.size() == POOL_SIZE || random() % 100 < 45);
+      if (release) {
+        size_t index = random() % groups.size();
+        heap.release(groups[index].object);
+        heap.release(groups[index].name);
+        heap.release(groups[index].id);
+        groups[index] = groups.back();
+        groups.pop_back();
+      } else {
+        HeapGroup group;
+        group.object = heap.allocate(RECORD_SIZE);
+        group.name = heap.allocate(1 + random() % LIGHT_GROUP_NAME_SIZE);
+        group.id = heap.allocate(LIGHT_GROUP_ID_SIZE);
+        if (group.object < 0 || group.name < 0 || group.id < 0) {
+          break;
+        }
+        groups.push_back(group);
+      }
+    }
+    // a request parses its body and builds the response, both are freed afterwards
+    long body = heap.allocate(64 + random() % 512);
+    long response = heap.allocate(256 + random() % 2048);
+    if (body >= 0) heap.release(body);
+    if (response >= 0) heap.release(response);
+    if (step % 1000 == 0) {
+      worst = std::max(worst, fragmentation(heap));
+      largest = std::min(largest, heap.largestFree());
+    }
+  }
+  return worst;
+}
+
+int main()
+{
+  static LightGroupPool<POOL_SIZE> pool;
+  JsonObject root;
+  std::mt19937 random(42);
+  std::vector<LightGroup*> used;
+  std::set<LightGroup*> usedSet;
+  int errors = 0;
+
+  for (long step = 0; step < SOAK_STEPS; step++) {
+    // keep the pool mostly full, the Hue app deletes and recreates scenes
+    bool release = !used.empty() && (used.size() == POOL_SIZE || random() % 100 < 45);
+    if (release) {
+      size_t index = random() % used.size();
+      LightGroup* group = used[index];
+      used[index] = used.back();
+      used.pop_back();
+      usedSet.erase(group);
+      pool.release(group);
+    } else {
+      LightGroup* group = pool.allocate(root);
+      if (group == nullptr) {
+        printf("step %ld: allocation failed with %zu of %d records used\n", step, used.size(), POOL_SIZE);
+        errors++;
+        break;
+      }
+      if (!usedSet.insert(group).second) {
+        printf("step %ld: record allocated twice\n", step);
+        errors++;
+        break;
+      }
+      used.push_back(group);
+    }
+    if (pool.available() != POOL_SIZE - (int)used.size()) {
+      printf("step %ld: %d available, expected %d\n", step, pool.available(), POOL_SIZE - (int)used.size());
+      errors++;
+      break;
+    }
+  }
+  // the pool must be exhausted exactly at its size and give all records back
+  while ((int)used.size() < POOL_SIZE && !errors) {
+    LightGroup* group = pool.allocate(root);
+    if (group == nullptr || !usedSet.insert(group).second) {
+      printf("fill: allocation failed or duplicated\n");
+      errors++;
+      break;
+    }
+    used.push_back(group);
+  }
+  if (pool.allocate(root) != nullptr) {
+    printf("full pool still allocates\n");
+    errors++;
+  }
+  for (LightGroup* group : used) {
+    pool.release(group);
+  }
+  if (pool.available() != POOL_SIZE) {
+    printf("%d of %d records available after releasing all\n", pool.available(), POOL_SIZE);
+    errors++;
+  }
+  printf("pool: %d records, %d steps, no heap use\n", POOL_SIZE, SOAK_STEPS);
+
+  // the same churn on a heap of the size of the ESP8266
+  size_t largestHeap = 0;
+  size_t largestPool = 0;
+  double fragmentationHeap = heapSoak(false, random, largestHeap);
+  double fragmentationPool = heapSoak(true, random, largestPool);
+  printf("worst heap fragmentation in %d requests: new/delete %.1f%% (smallest largest free block %zu), pool %.1f%% (%zu)\n",
+         HEAP_STEPS, fragmentationHeap, largestHeap, fragmentationPool, largestPool);
+
+  printf(errors ? "FAILED\n" : "OK\n");
+  return errors ? 1 : 0;
+}
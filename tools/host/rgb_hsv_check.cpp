@@ -0,0 +1,98 @@
+/**************************************************************
+
+This file is a part of
+https://github.com/atiderko/esp8266-ansulta-alexa
+Copyright (c) 2018 Alexander Tiderko
+
+Licensed under MIT license
+
+Compares the fixed point hsvcolor of HueTypes.h with the float
+conversion it replaced over all 16.7M RGB inputs. Hue and
+saturation must not differ by more than one LSB.
+
+  g++ -std=c++11 -O2 -Itools/host -Iansulta tools/host/rgb_hsv_check.cpp -o rgb_hsv_check
+
+**************************************************************/
+#include <stdio.h>
+#include <chrono>
+#include <Arduino.h>
+#include "HueTypes.h"
+
+using namespace hue;
+
+// hsvcolor with getHue() and getSaturation() before the fixed point version
+struct FloatHsv {
+  FloatHsv(const rgbcolor& color) {
+    float r = ((float)color.r)/COLOR_SATURATION;
+    float g = ((float)color.g)/COLOR_SATURATION;
+    float b = ((float)color.b)/COLOR_SATURATION;
+    float mi = std::min(std::min(r, g), b);
+    float ma = std::max(std::max(r, g), b);
+    float diff = ma - mi;
+    v = ma;
+    h = 0;
+    s = (!v)?0:(diff/ma);
+    if (diff) {
+      if (r == v) {
+        h = (g - b) / diff + (g < b ? 6.0f : 0.0f);
+      } else if (g == v) {
+        h = (b - r) / diff + 2.0f;
+      } else {
+        h = (r - g) / diff + 4.0f;
+      }
+      h /= 6.0f;
+    }
+  }
+  int hue() const { return h * 360 * 182.04; }
+  int saturation() const { return s * COLOR_SATURATION; }
+  float h;
+  float s;
+  float v;
+};
+
+int main()
+{
+  int maxHueError = 0;
+  int maxSatError = 0;
+  uint32_t hueDiffs = 0;
+  uint32_t satDiffs = 0;
+  for (uint32_t rgb = 0; rgb < (1u << 24); rgb++) {
+    rgbcolor color(rgb >> 16, (rgb >> 8) & 0xFF, rgb & 0xFF);
+    hsvcolor fixed(color);
+    FloatHsv reference(color);
+    int hueError = abs((int)fixed.h - reference.hue());
+    int satError = abs((int)fixed.s - reference.saturation());
+    if (hueError) hueDiffs++;
+    if (satError) satDiffs++;
+    if (hueError > maxHueError || satError > maxSatError) {
+      if (hueError > 1 || satError > 1) {
+        printf("rgb %06X: hue %d/%d sat %d/%d\n", rgb, fixed.h, reference.hue(), fixed.s, reference.saturation());
+      }
+      maxHueError = std::max(maxHueError, hueError);
+      maxSatError = std::max(maxSatError, satError);
+    }
+  }
+  printf("hue: max error %d LSB, %u inputs differ\n", maxHueError, hueDiffs);
+  printf("sat: max error %d LSB, %u inputs differ\n", maxSatError, satDiffs);
+
+  // same inputs for both, the sum keeps the compiler from dropping the loops
+  volatile uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t rgb = 0; rgb < (1u << 24); rgb++) {
+    hsvcolor hsv(rgbcolor(rgb >> 16, (rgb >> 8) & 0xFF, rgb & 0xFF));
+    sink += hsv.h + hsv.s;
+  }
+  auto middle = std::chrono::steady_clock::now();
+  for (uint32_t rgb = 0; rgb < (1u << 24); rgb++) {
+    FloatHsv hsv(rgbcolor(rgb >> 16, (rgb >> 8) & 0xFF, rgb & 0xFF));
+    sink += hsv.hue() + hsv.saturation();
+  }
+  auto end = std::chrono::steady_clock::now();
+  printf("fixed point %.1f ns, float %.1f ns per conversion\n",
+         std::chrono::duration<double, std::nano>(middle - start).count() / (1u << 24),
+         std::chrono::duration<double, std::nano>(end - middle).count() / (1u << 24));
+
+  bool ok = maxHueError <= 1 && maxSatError <= 1;
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
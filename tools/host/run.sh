@@ -0,0 +1,25 @@
+#!/bin/sh
+# Builds and runs the host checks of the firmware sources, call it from the repository root.
+set -e
+CXX=${CXX:-g++}
+OUT=${OUT:-/tmp/ansulta-host}
+mkdir -p "$OUT"
+FLAGS="-std=c++11 -O2 -Wall -Itools/host -Iansulta"
+
+$CXX $FLAGS tools/host/color_tables_check.cpp ansulta/HueColorTables.cpp -o "$OUT/color_tables_check"
+"$OUT/color_tables_check"
+
+$CXX $FLAGS tools/host/rgb_hsv_check.cpp -o "$OUT/rgb_hsv_check"
+"$OUT/rgb_hsv_check"
+
+$CXX $FLAGS tools/host/group_pool_soak.cpp -o "$OUT/group_pool_soak"
+"$OUT/group_pool_soak"
+$CXX $FLAGS -DMAX_LIGHT_GROUPS=64 tools/host/group_pool_soak.cpp -o "$OUT/group_pool_soak_64"
+"$OUT/group_pool_soak_64"
+
+# the sketch gets Arduino.h from the IDE, Ansulta.h relies on it
+RADIO="$FLAGS -include Arduino.h -include vector"
+$CXX $RADIO tools/host/frame_decoder_fuzz.cpp ansulta/Ansulta.cpp -o "$OUT/frame_decoder_fuzz"
+"$OUT/frame_decoder_fuzz"
+$CXX $RADIO -g -fsanitize=address,undefined -fno-sanitize-recover=undefined tools/host/frame_decoder_fuzz.cpp ansulta/Ansulta.cpp -o "$OUT/frame_decoder_fuzz_asan"
+"$OUT/frame_decoder_fuzz_asan"
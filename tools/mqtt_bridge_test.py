@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Tests the MQTT bridge of a running esp8266-ansulta-alexa against its broker.
+
+    pip3 install paho-mqtt
+    python3 tools/mqtt_bridge_test.py <broker> [--prefix ansulta] [--light 1]
+    python3 tools/mqtt_bridge_test.py localhost \\
+        --stop-cmd 'systemctl stop mosquitto' --start-cmd 'systemctl start mosquitto'
+
+The device has to be configured with the same broker and prefix. The tests
+switch the light, the state before the test is restored at the end:
+  status      <prefix>/status is "online", retained
+  state       <prefix>/light/<n>/state is retained and has "on" and "bri"
+  set         a command on <prefix>/light/<n>/set is published as new state
+  coalescing  a burst of commands ends in the last state with fewer messages
+  reconnect   after a broker restart the device connects again and publishes
+              its states, only with --stop-cmd and --start-cmd
+
+The topics and the timings are described in ansulta/mqtt_bridge.h.
+"""
+import argparse
+import json
+import queue
+import subprocess
+import sys
+import time
+
+import paho.mqtt.client as mqtt
+
+BACKOFF_MAX_S = 60            # MQTT_BACKOFF_MAX_MS
+PUBLISH_INTERVAL_S = 0.1      # MQTT_PUBLISH_INTERVAL_MS
+COMMAND_TIMEOUT_S = 5         # the radio sends each command as a burst of packets
+BURST = 20
+BROKER_DOWN_S = 5             # the device backoff grows beyond the reconnect delay of this client
+
+
+class Monitor:
+    """Collects the messages of the topics of one light, the retained ones are marked."""
+
+    def __init__(self, args):
+        self.args = args
+        self.status_topic = '%s/status' % args.prefix
+        self.state_topic = '%s/light/%d/state' % (args.prefix, args.light)
+        self.set_topic = '%s/light/%d/set' % (args.prefix, args.light)
+        self.messages = queue.Queue()
+        if hasattr(mqtt, 'CallbackAPIVersion'):
+            self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+        else:
+            self.client = mqtt.Client()
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+        self.client.reconnect_delay_set(min_delay=1, max_delay=1)
+        self.client.connect(args.broker, args.port)
+        self.client.loop_start()
+
+    def on_connect(self, client, *args):  # the arguments differ between paho-mqtt 1.x and 2.x
+        client.subscribe([(self.status_topic, 0), (self.state_topic, 0)])
+
+    def on_message(self, client, userdata, message):
+        self.messages.put((time.time(), message.topic, message.payload.decode(), bool(message.retain)))
+
+    def wait(self, topic, timeout, live=False, match=None):
+        """Returns the payload of the next message of the topic or None on timeout."""
+        end = time.time() + timeout
+        while True:
+            try:
+                _, msg_topic, payload, retained = self.messages.get(timeout=max(0, end - time.time()))
+            except queue.Empty:
+                return None
+            if msg_topic == topic and not (live and retained) and (match is None or match(payload)):
+                return payload
+
+    def drain(self, seconds):
+        """Returns the messages received within the next seconds."""
+        time.sleep(seconds)
+        messages = []
+        while not self.messages.empty():
+            messages.append(self.messages.get())
+        return messages
+
+    def send(self, state):
+        self.client.publish(self.set_topic, json.dumps(state))
+
+    def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def state_is(expected):
+    def match(payload):
+        try:
+            state = json.loads(payload)
+        except ValueError:
+            return False
+        return all(state.get(key) == value for key, value in expected.items())
+    return match
+
+
+def test_status(monitor):
+    payload = monitor.wait(monitor.status_topic, 2)
+    return payload == 'online', 'status %r' % payload
+
+
+def test_state(monitor):
+    payload = monitor.wait(monitor.state_topic, 2)
+    if payload is None:
+        return False, 'no retained state, is light %d configured?' % monitor.args.light
+    state = json.loads(payload)
+    monitor.initial = state
+    ok = isinstance(state.get('on'), bool) and 1 <= state.get('bri', 0) <= 254
+    return ok, payload
+
+
+def test_set(monitor):
+    for state in ({'on': True, 'bri': 100}, {'on': False}):
+        monitor.send(state)
+        start = time.time()
+        if monitor.wait(monitor.state_topic, COMMAND_TIMEOUT_S, live=True, match=state_is(state)) is None:
+            return False, 'no state for %s' % json.dumps(state)
+    return True, 'state after %.0f ms' % ((time.time() - start) * 1000)
+
+
+def test_coalescing(monitor):
+    monitor.drain(1)
+    states = [{'on': True, 'bri': 10 + i} for i in range(BURST)]
+    for state in states:
+        monitor.send(state)
+    messages = [m for m in monitor.drain(COMMAND_TIMEOUT_S) if m[1] == monitor.state_topic]
+    if not messages:
+        return False, 'no state'
+    last = messages[-1][2]
+    ok = state_is(states[-1])(last) and len(messages) < BURST
+    return ok, '%d commands, %d states, last %s' % (BURST, len(messages), last)
+
+
+def test_reconnect(monitor):
+    args = monitor.args
+    subprocess.check_call(args.stop_cmd, shell=True)
+    time.sleep(BROKER_DOWN_S)
+    subprocess.check_call(args.start_cmd, shell=True)
+    start = time.time()
+    # this client is back within a second, the states of the device arrive live after its reconnect
+    payload = monitor.wait(monitor.state_topic, BACKOFF_MAX_S + 10, live=True)
+    if payload is None:
+        return False, 'no state within %d s after the restart' % (BACKOFF_MAX_S + 10)
+    return True, 'states again after %.1f s' % (time.time() - start)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('broker')
+    parser.add_argument('--port', type=int, default=1883)
+    parser.add_argument('--prefix', default='ansulta')
+    parser.add_argument('--light', type=int, default=1, help='1-based light number')
+    parser.add_argument('--stop-cmd', help='stops the broker, e.g. systemctl stop mosquitto')
+    parser.add_argument('--start-cmd', help='starts the broker again')
+    args = parser.parse_args()
+
+    monitor = Monitor(args)
+    monitor.initial = None
+    tests = [test_status, test_state, test_set, test_coalescing]
+    if args.stop_cmd and args.start_cmd:
+        tests.append(test_reconnect)
+    failed = 0
+    try:
+        for test in tests:
+            ok, detail = test(monitor)
+            failed += 0 if ok else 1
+            print('%-16s %-4s %s' % (test.__name__[5:], 'ok' if ok else 'FAIL', detail))
+            sys.stdout.flush()
+    finally:
+        if monitor.initial is not None:
+            monitor.send(monitor.initial)
+            time.sleep(PUBLISH_INTERVAL_S * 5)
+        monitor.close()
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
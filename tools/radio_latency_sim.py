@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Estimates the time of a light command burst with and without the synthesizer autocalibration.
+
+The radio configuration is read from ansulta/cc2500_VAL.h, the chip timings
+are the typical values of the CC2500 datasheet (26 MHz crystal), the delays
+are the ones of Ansulta::SendCommand() and Ansulta::read_cmd().
+
+    python3 tools/radio_latency_sim.py [packets]
+
+The per-packet path (TX_PER_PACKET in debug.h) goes IDLE->TX for each packet,
+with FS_AUTOCAL every transition calibrates the synthesizer first. The burst
+path goes to TX once, so there the calibration is paid once per command and
+in the RX path once per SRX. Compare the results with the TX_BURST to TX_DONE
+durations printed by tools/trace_decode.py on the device.
+"""
+import os
+import re
+import sys
+
+VAL_FILE = os.path.join(os.path.dirname(__file__), '..', 'ansulta', 'cc2500_VAL.h')
+
+XOSC_HZ = 26e6
+CAL_US = 721          # manual or automatic calibration of the synthesizer
+SETTLE_TX_US = 88.4   # IDLE->TX without calibration (FS wake up and settling)
+SETTLE_RX_US = 88.4   # IDLE->RX without calibration
+SPI_HZ = 6e6
+SPI_CS_US = 2.0       # chip select, CHIP_RDY poll and the digitalWrite calls
+
+# delays of the per-packet path in Ansulta.cpp
+DELAY_B_US = 2000     # after each strobe
+DELAY_C_US = 255      # after STX
+TX_TAIL_US = 200      # burst path, CRC of the last packet
+FRAME_BYTES = 7       # length byte and the 6 bytes of the Ansulta frame
+PRELOAD_FRAMES = 64 // FRAME_BYTES
+
+
+def registers():
+    values = {}
+    with open(VAL_FILE) as f:
+        for match in re.finditer(r'#define\s+VAL_(\w+)\s+0x([0-9A-Fa-f]+)', f.read()):
+            values[match.group(1)] = int(match.group(2), 16)
+    return values
+
+
+def airtime_us(reg):
+    drate_e = reg['MDMCFG4'] & 0x0F
+    drate_m = reg['MDMCFG3']
+    rate = (256 + drate_m) * 2 ** drate_e / 2 ** 28 * XOSC_HZ
+    preamble = [2, 3, 4, 6, 8, 12, 16, 24][(reg['MDMCFG1'] >> 4) & 0x07]
+    sync = 4 if (reg['MDMCFG2'] & 0x03) == 3 else 2  # 30/32 sends the sync word twice
+    crc = 2 if reg['PKTCTRL0'] & 0x04 else 0
+    return (preamble + sync + FRAME_BYTES + crc) * 8 / rate * 1e6, rate
+
+
+def spi_us(count):
+    return SPI_CS_US + count * 8 / SPI_HZ * 1e6
+
+
+def per_packet(packets, air, autocal):
+    """Per packet: SIDLE, SFTX, FIFO write, STX, the packet is sent during the delays."""
+    settle = SETTLE_TX_US + (CAL_US if autocal else 0)
+    on_air = settle + air
+    window = DELAY_B_US + DELAY_C_US
+    step = 3 * spi_us(1) + spi_us(1 + FRAME_BYTES) + 3 * DELAY_B_US + DELAY_C_US
+    # without the delays the loop could start the next packet as soon as this one is on air
+    tight = 3 * spi_us(1) + spi_us(1 + FRAME_BYTES) + on_air
+    return packets * step, packets * tight, on_air > window
+
+
+def burst(packets, air, autocal):
+    """One STX, the FIFO is refilled while the radio stays in TX."""
+    setup = 2 * spi_us(1) + 2 * spi_us(2) + spi_us(1 + min(packets, PRELOAD_FRAMES) * FRAME_BYTES) + spi_us(1)
+    settle = SETTLE_TX_US + (CAL_US if autocal else 0)
+    return setup + settle + packets * air + TX_TAIL_US + 2 * spi_us(1) + spi_us(2)
+
+
+def main():
+    packets = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+    reg = registers()
+    air, rate = airtime_us(reg)
+    print('data rate %.1f kbps, packet on air %.0f us, %d packets per command' % (rate / 1000, air, packets))
+    print('FS_AUTOCAL of VAL_MCSM0: %s, init() clears it' % ('on' if reg['MCSM0'] & 0x30 else 'off'))
+    print()
+    print('%-34s %12s %12s %10s' % ('path', 'autocal', 'manual cal', 'saved'))
+    slow_auto, tight_auto, cut_auto = per_packet(packets, air, True)
+    slow_man, tight_man, cut_man = per_packet(packets, air, False)
+    print('%-34s %10.1fms %10.1fms %8.1fms' % ('per packet, delays of the code', slow_auto / 1e3, slow_man / 1e3, (slow_auto - slow_man) / 1e3))
+    print('%-34s %10.1fms %10.1fms %8.1fms' % ('per packet, wait only for the air', tight_auto / 1e3, tight_man / 1e3, (tight_auto - tight_man) / 1e3))
+    burst_auto = burst(packets, air, True)
+    burst_man = burst(packets, air, False)
+    print('%-34s %10.1fms %10.1fms %8.1fms' % ('burst (TXOFF_MODE=TX)', burst_auto / 1e3, burst_man / 1e3, (burst_auto - burst_man) / 1e3))
+    rx_auto = spi_us(1) + SETTLE_RX_US + CAL_US
+    rx_man = spi_us(1) + SETTLE_RX_US
+    print('%-34s %10.0fus %10.0fus %8.0fus' % ('restart of RX (SRX)', rx_auto, rx_man, rx_auto - rx_man))
+    if cut_auto or cut_man:
+        print('\nwarning: a packet needs longer than the delays after STX, the next SIDLE cuts it off')
+    print('\nThe per-packet delays of the code hide the calibration, it only shows once the')
+    print('delays are gone. Without autocal the command is %.1f%% shorter on that path.'
+          % (100.0 * (tight_auto - tight_man) / tight_auto))
+
+
+if __name__ == '__main__':
+    main()
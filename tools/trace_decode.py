@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Decodes the binary trace of esp8266-ansulta-alexa into a readable timeline.
+
+The dump can be fetched by HTTP or recorded from the serial port:
+
+    curl -s http://<ip>/trace > trace.bin
+    python3 tools/trace_decode.py trace.bin
+
+Serial recordings may contain several dumps mixed with other output,
+every dump starting with the magic 'ATRC' is decoded.
+"""
+import struct
+import sys
+
+MAGIC = b'ATRC'
+HEADER = struct.Struct('<4sBBHI')
+RECORD = struct.Struct('<IBBH')
+
+# keep in sync with the event ids in ansulta/trace.h
+EVENTS = {
+    0x01: ('TX_BURST', 'cmd=0x{a0:02X} packets={a1}'),
+    0x02: ('TX_PACKET', 'index={a0}'),
+    0x03: ('TX_DONE', 'cmd=0x{a0:02X}'),
+    0x04: ('RADIO_CAL', 'fscal1=0x{a0:02X} fscal3/2=0x{a1:04X}'),
+    0x05: ('TX_BACKOFF', 'cmd=0x{a0:02X} backoff={a1}'),
+    0x10: ('RX_PACKET', 'length={a0}'),
+    0x11: ('RX_COMMAND', 'cmd=0x{a0:02X} address={a1:04X}'),
+    0x12: ('RX_REJECTED', 'length={a0}'),
+    0x20: ('LIGHT_STATE', 'state=0x{a0:02X} remote={a1}'),
+    0x30: ('HTTP_REQUEST', 'method={a0} duration={a1}ms'),
+}
+
+
+def records(data):
+    pos = data.find(MAGIC)
+    while pos >= 0 and pos + HEADER.size <= len(data):
+        _, version, size, count, dropped = HEADER.unpack_from(data, pos)
+        pos += HEADER.size
+        if version != 1 or size != RECORD.size:
+            sys.stderr.write('skip dump with unknown version %d\n' % version)
+        else:
+            if dropped:
+                yield None, dropped
+            for _ in range(count):
+                if pos + RECORD.size > len(data):
+                    sys.stderr.write('truncated dump\n')
+                    return
+                yield RECORD.unpack_from(data, pos), 0
+                pos += RECORD.size
+        pos = data.find(MAGIC, pos)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('usage: %s <dump file>' % sys.argv[0])
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+    last_ts = None
+    burst_ts = None
+    for record, dropped in records(data):
+        if record is None:
+            print('--- %d records dropped ---' % dropped)
+            last_ts = None
+            burst_ts = None
+            continue
+        ts, event, a0, a1 = record
+        # the timestamp is micros() and wraps after 71 minutes
+        delta = 0 if last_ts is None else (ts - last_ts) & 0xFFFFFFFF
+        last_ts = ts
+        name, fmt = EVENTS.get(event, ('EVENT_0x%02X' % event, 'arg0={a0} arg1={a1}'))
+        text = fmt.format(a0=a0, a1=a1)
+        # the latency of a command is the time from TX_BURST to TX_DONE
+        if event == 0x01:
+            burst_ts = ts
+        elif event == 0x03 and burst_ts is not None:
+            text += ' burst=%dus' % ((ts - burst_ts) & 0xFFFFFFFF)
+            burst_ts = None
+        print('%12.6f  +%9dus  %-13s %s' % (ts / 1e6, delta, name, text))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Switches a light of esp8266-ansulta-alexa with the binary UDP control protocol.
+
+    python3 tools/udp_control.py <ip> on [--bri 127]
+    python3 tools/udp_control.py <ip> off
+    python3 tools/udp_control.py <ip> status
+
+The packet layout is described in ansulta/HueUdpControl.h.
+"""
+import argparse
+import random
+import socket
+import struct
+import sys
+
+PACKET = struct.Struct('<2sBBHBBBBBBI')
+VERSION = 1
+TYPE_SET = 0x01
+TYPE_GET = 0x02
+FLAG_ON = 0x01
+FLAG_BRI = 0x02
+STATUS = {
+    0x00: 'ok',
+    0x01: 'duplicate',
+    0x02: 'stale sequence',
+    0x03: 'bad light',
+    0x04: 'denied',
+    0x05: 'bad type',
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('host')
+    parser.add_argument('command', choices=['on', 'off', 'status'])
+    parser.add_argument('--light', type=int, default=1, help='1-based light number, 0 for all lights')
+    parser.add_argument('--bri', type=int, help='brightness 1..254')
+    parser.add_argument('--token', type=int, default=0)
+    parser.add_argument('--port', type=int, default=8266)
+    parser.add_argument('--seq', type=int, default=random.randint(0, 0xFFFF))
+    args = parser.parse_args()
+
+    flags = 0
+    on = 0
+    bri = 0
+    msg_type = TYPE_GET
+    if args.command != 'status':
+        msg_type = TYPE_SET
+        flags |= FLAG_ON
+        on = 1 if args.command == 'on' else 0
+        if args.bri is not None:
+            flags |= FLAG_BRI
+            bri = args.bri
+    packet = PACKET.pack(b'AU', VERSION, msg_type, args.seq, args.light, flags, on, bri, 0, 0, args.token)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(1.0)
+    # the command is idempotent, retransmit the same sequence number on timeout
+    for _ in range(3):
+        sock.sendto(packet, (args.host, args.port))
+        try:
+            data, _ = sock.recvfrom(64)
+        except socket.timeout:
+            continue
+        if len(data) != PACKET.size:
+            continue
+        _, _, _, seq, light, flags, on, bri, status, _, _ = PACKET.unpack(data)
+        if seq != args.seq:
+            continue
+        print('light %d: %s, on=%d bri=%d' % (light, STATUS.get(status, 'status %d' % status), on, bri))
+        return 0 if status in (0x00, 0x01) else 1
+    sys.stderr.write('no reply from %s:%d\n' % (args.host, args.port))
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())